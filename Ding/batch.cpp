@@ -0,0 +1,478 @@
+// Headless batch driver: no window, no vsync, no rendering.
+// Runs the diamond-square workload to completion as fast as the host
+// allows and prints the final cost and per-level hit rates, so cache
+// configurations can be evaluated from scripts:
+//   batch.exe l1.size=16384 l1.ways=8 > result.txt
+// Off Windows, the Makefile builds it as ./batch.
+// Driver options (not cache settings):
+//   record=<file>   write the memory access trace to <file>
+//   replay=<file>   instead of running the workload, stream a recorded
+//                   trace through the hierarchy and report throughput
+//   mrc=<file>      with replay: skip the simulation and compute LRU
+//                   miss-ratio curves for all sizes and associativities
+//                   in one pass; the summary goes to stdout, every
+//                   capacity to <file> (CSV)
+//   sweep=<file>    with replay: run every configuration listed in
+//                   <file> (see sweep.h) in parallel on the JobManager
+//                   and print a results table
+//   threads=<n>     worker threads for sweeps and mrc (default: all cores)
+//   pin=1           pin every worker thread to its own core
+//   numa=1          group the workers by NUMA node, with a job queue per
+//                   node; every worker is bound to its node's processors,
+//                   so each job allocates its hierarchy on the node it runs on
+//   hot=1           keep idle workers spinning between dispatches instead
+//                   of sleeping (mrc dispatches once per trace chunk)
+//   opt=1           with replay or sweep: also replay every configuration
+//                   with all levels on Belady OPT (see opt.h), and report
+//                   its cost next to that of the configured policies
+//   check=1         run the self-checks below and exit (non-zero on a
+//                   failure); make check does the same
+
+#include "template.h"
+
+// run the diamond-square workload, optionally recording its trace
+static int RunGame( const HierarchyConfig& config, const char* recordFile )
+{
+	Game* game = new Game();
+	game->SetConfig( config );
+	TraceWriter trace;
+	if (recordFile)
+	{
+		if (!trace.Open( recordFile ))
+		{
+			printf( "could not create trace file %s\n", recordFile );
+			return 1;
+		}
+		game->SetTrace( &trace );
+	}
+	Timer timer;
+	game->Init();
+	// run until the task stack is empty; large steps, nothing else to do in between
+	while (game->Step( 4096 ));
+	float elapsed = timer.elapsed();
+	game->UpdateStats();
+	game->Report( true );
+	printf( "wall time: %.1f ms\n", elapsed );
+	if (recordFile)
+	{
+		trace.Close();
+		printf( "trace: %llu accesses, %llu bytes encoded, %llu bytes written to %s\n", trace.records, trace.rawBytes, trace.packedBytes, recordFile );
+	}
+	game->Shutdown();
+	delete game;
+	return 0;
+}
+
+// first pass of OPT: the next use of every access in the trace
+static NextUse* BuildNextUse( const HierarchyConfig& config, const char* replayFile )
+{
+	NextUse* uses = new NextUse();
+	Timer timer;
+	if (!uses->Build( replayFile, config.lineSize ))
+	{
+		printf( "could not read trace file %s for OPT\n", replayFile );
+		delete uses;
+		return 0;
+	}
+	printf( "next-use pass (%i-byte lines): %u accesses in %.1f ms\n", config.lineSize, uses->count, timer.elapsed() );
+	return uses;
+}
+
+// the same trace with every level on OPT: how much better replacement alone could do
+static void CompareOPT( const Hierarchy* hierarchy, const char* replayFile, const NextUse* uses )
+{
+	HierarchyConfig config = hierarchy->config;
+	SetOPT( config );
+	Hierarchy* opt = new Hierarchy( config );
+	opt->SetNextUse( uses );
+	TraceReader reader;
+	reader.Open( replayFile );
+	TraceRecord* records = new TraceRecord[REPLAYCHUNK];
+	int count;
+	while ((count = reader.Read( records, REPLAYCHUNK )) > 0) opt->Replay( records, count );
+	opt->UpdateStats();
+	printf( "%-12s %14s", "policy", "cycles" );
+	for (int i = 0; i < config.levels; i++) printf( "   L%i misses", i + 1 );
+	printf( "\n" );
+	const Hierarchy* h[2] = { hierarchy, opt };
+	for (int j = 0; j < 2; j++)
+	{
+		printf( "%-12s %14llu", j ? "OPT" : "configured", h[j]->clock.cycles );
+		for (int i = 0; i < config.levels; i++)
+		{
+			int hits, misses;
+			h[j]->Totals( i, hits, misses );
+			printf( " %11i", misses );
+		}
+		printf( "\n" );
+	}
+	printf( "OPT saves %.2f%% of the cycles\n", hierarchy->clock.cycles ? (1.0 - (double)opt->clock.cycles / hierarchy->clock.cycles) * 100 : 0.0 );
+	delete[] records;
+	delete opt;
+}
+
+// stream a trace through the hierarchy: no workload, rendering or RNG
+static int RunReplay( const HierarchyConfig& config, const char* replayFile, bool opt )
+{
+	TraceReader reader;
+	if (!reader.Open( replayFile ))
+	{
+		printf( "could not open trace file %s\n", replayFile );
+		return 1;
+	}
+	NextUse* uses = 0;
+	if ((opt || UsesOPT( config )) && !(uses = BuildNextUse( config, replayFile ))) return 1;
+	Hierarchy* hierarchy = new Hierarchy( config );
+	if (uses) hierarchy->SetNextUse( uses );
+	TraceRecord* records = new TraceRecord[REPLAYCHUNK];
+	unsigned long long accesses = 0;
+	Timer timer;
+	int count;
+	while ((count = reader.Read( records, REPLAYCHUNK )) > 0)
+	{
+		hierarchy->Replay( records, count );
+		accesses += count;
+	}
+	float elapsed = timer.elapsed();
+	if (count < 0) printf( "trace file %s is corrupt at offset %llu; results cover the first %llu accesses\n", replayFile, reader.offset, accesses );
+	hierarchy->UpdateStats();
+	hierarchy->Report( true );
+	printf( "replayed %llu accesses (%llu byte trace) in %.1f ms: %.2fM accesses/s\n", accesses, reader.fileSize, elapsed,
+		elapsed > 0 ? accesses / (elapsed * 1000.0) : 0.0 );
+	if (opt && count == 0) CompareOPT( hierarchy, replayFile, uses );
+	delete[] records;
+	delete hierarchy;
+	delete uses;
+	return count < 0 ? 1 : 0;
+}
+
+// single-pass stack distance analysis of a trace
+static int RunMissRatio( const HierarchyConfig& config, const char* replayFile, const char* mrcFile )
+{
+	TraceReader reader;
+	if (!reader.Open( replayFile ))
+	{
+		printf( "could not open trace file %s\n", replayFile );
+		return 1;
+	}
+	MissRatioAnalysis* mrc = new MissRatioAnalysis( config.lineSize );
+	TraceRecord* records = new TraceRecord[REPLAYCHUNK];
+	Timer timer;
+	int count;
+	while ((count = reader.Read( records, REPLAYCHUNK )) > 0) mrc->Replay( records, count );
+	float elapsed = timer.elapsed();
+	if (count < 0) printf( "trace file %s is corrupt at offset %llu\n", replayFile, reader.offset );
+	mrc->Print();
+	printf( "analysis time: %.1f ms\n", elapsed );
+	if (!mrc->Write( mrcFile )) printf( "could not create %s\n", mrcFile );
+	if (JobManager::GetJobManager()) JobManager::GetJobManager()->PrintStats();
+	delete[] records;
+	delete mrc;
+	return count < 0 ? 1 : 0;
+}
+
+// many configurations, one job each
+static int RunSweep( const HierarchyConfig& config, const char* replayFile, const char* sweepFile, bool opt )
+{
+	Sweep sweep;
+	if (!sweep.Load( sweepFile, config ))
+	{
+		printf( "could not open sweep file %s\n", sweepFile );
+		return 1;
+	}
+	// next-use times are per line: one pass serves all configurations with the same line size
+	std::vector<NextUse*> uses;
+	for (size_t i = 0; i < sweep.jobs.size(); i++)
+	{
+		const HierarchyConfig& c = sweep.jobs[i]->config;
+		if (!opt && !UsesOPT( c )) continue;
+		bool built = false;
+		for (size_t u = 0; u < uses.size(); u++) built |= 1 << uses[u]->lineShift == c.lineSize;
+		if (built) continue;
+		NextUse* u = BuildNextUse( c, replayFile );
+		if (!u)
+		{
+			for (size_t j = 0; j < uses.size(); j++) delete uses[j];
+			return 1;
+		}
+		uses.push_back( u );
+	}
+	JobManager* manager = JobManager::GetJobManager();
+	printf( "sweeping %i configurations on %i threads, %i node(s)\n", (int)sweep.jobs.size(), manager->GetNumThreads(), manager->GetNumNodes() );
+	Timer timer;
+	sweep.Run( replayFile, uses, opt );
+	float elapsed = timer.elapsed();
+	sweep.Print();
+	unsigned long long accesses = 0;
+	for (size_t i = 0; i < sweep.jobs.size(); i++) if (sweep.jobs[i]->done) accesses += sweep.jobs[i]->accesses;
+	printf( "wall time: %.1f ms, %.2fM accesses/s over all configurations\n", elapsed, elapsed > 0 ? accesses / (elapsed * 1000.0) : 0.0 );
+	manager->PrintStats();
+	for (size_t u = 0; u < uses.size(); u++) delete uses[u];
+	return 0;
+}
+
+// ------------------------------------------------------------------
+// SELF-CHECKS
+// Invariants of the simulator that the reports rely on, each on a
+// small hierarchy of its own; the cache configuration is not used.
+// ------------------------------------------------------------------
+
+#define SETUPARGS		16						// key=value pairs in a check's setup, at most
+
+// apply a check's setup, space-separated key=value pairs, on top of config
+static bool ParseSetup( const char* setup, HierarchyConfig& config )
+{
+	char text[256], *args[SETUPARGS + 1] = { 0 };
+	if (strlen( setup ) >= sizeof( text )) { printf( "  setup '%s' too long\n", setup ); return false; }
+	strcpy( text, setup );
+	int count = 1; // args[0]: the program name, as for Parse
+	for (char* token = strtok( text, " " ); token; token = strtok( 0, " " ))
+	{
+		if (count > SETUPARGS) { printf( "  setup '%s' has more than %i settings\n", setup, SETUPARGS ); return false; }
+		args[count++] = token;
+	}
+	if (config.Parse( count, args ) && config.Validate()) return true;
+	printf( "  invalid setup '%s'\n", setup );
+	return false;
+}
+
+// a cold miss, read or write, from any core finds no copy elsewhere: no coherence traffic
+static bool CheckColdMisses()
+{
+	bool ok = true;
+	HierarchyConfig config;
+	config.cores = 4;
+	for (int p = CO_MESI; p <= CO_MOESI; p++) for (int c = 0; c < config.cores; c++) for (int w = 0; w < 2; w++)
+	{
+		config.coherence = (CoherenceProtocol)p;
+		Hierarchy h( config );
+		h.Access( 4096, 1, w != 0, 0, c );
+		const CoherenceStats& s = h.coherence->stats;
+		if (s.upgrades || s.downgrades || s.invalidations || s.writebacks || s.cycles)
+		{
+			printf( "  %s %s by core %i: %i upgrades, %i downgrades, %i invalidations, %llu snoop cycles\n", config.coherence == CO_MOESI ? "MOESI" : "MESI",
+				w ? "write" : "read", c, s.upgrades, s.downgrades, s.invalidations, s.cycles );
+			ok = false;
+		}
+	}
+	return ok;
+}
+
+// every miss of every level falls in exactly one of the three classes, whatever the inclusion policy
+static bool CheckMissClasses()
+{
+	static const char* setups[] = { "", "l2.inclusion=inclusive l3.inclusion=inclusive", "l2.inclusion=exclusive", "l3.inclusion=exclusive",
+		"l2.inclusion=exclusive l2.victims=4", "cores=2 l2.inclusion=exclusive", "l1.allocate=0 l3.admission=1" };
+	bool ok = true;
+	for (int s = 0; s < (int)(sizeof( setups ) / sizeof( setups[0] )); s++)
+	{
+		HierarchyConfig config;
+		config.classify = 1;
+		if (!ParseSetup( setups[s], config )) { ok = false; continue; }
+		Hierarchy h( config );
+		srand( 1 );
+		// a 513-byte row stride over more data than the last level holds, with some writes
+		for (int i = 0; i < 200000; i++) h.Access( (rand() % 1024) * 513, 1, (i & 7) == 0, 0, i % config.cores );
+		h.UpdateStats();
+		for (int c = 0; c < config.cores; c++) for (int i = 0; i < config.levels; i++) if (c == 0 || i < config.levels - 1)
+		{
+			const Cache* l = h.stack[c][i];
+			const MissClassifier* m = l->classifier;
+			if (m->cum_compulsory + m->cum_capacity + m->cum_conflict == l->cum_misses) continue;
+			printf( "  '%s' L%i core %i: %i misses, but %i compulsory + %i capacity + %i conflict\n", setups[s], i + 1, c,
+				l->cum_misses, m->cum_compulsory, m->cum_capacity, m->cum_conflict );
+			ok = false;
+		}
+	}
+	return ok;
+}
+
+// prefetch fills run off the clock, so only demand work may be in the levels' costs:
+// together with RAM, the snoops and the waits for late prefetches they make up the total
+static bool CheckPrefetchCosts()
+{
+	static const char* setups[] = { "l1.prefetch=next", "l1.prefetch=stride l2.prefetch=stream", "l2.prefetch=region l2.victims=4",
+		"l1.prefetch=next l2.inclusion=exclusive", "l1.prefetch=next l3.inclusion=inclusive", "cores=2 l1.prefetch=next l2.prefetch=stride" };
+	bool ok = true;
+	for (int s = 0; s < (int)(sizeof( setups ) / sizeof( setups[0] )); s++)
+	{
+		HierarchyConfig config;
+		if (!ParseSetup( setups[s], config )) { ok = false; continue; }
+		Hierarchy h( config );
+		srand( 1 );
+		// sequential runs for the prefetchers, random rows to evict what they bring
+		for (int i = 0; i < 200000; i++) h.Access( i & 1 ? (i * 2) % 65536 : (rand() % 1024) * 513, 1, (i & 7) == 0, 0, i % config.cores );
+		unsigned long long sum = h.memory->totalCost + (h.coherence ? h.coherence->stats.cycles : 0), hidden = h.memory->pfCost;
+		for (int c = 0; c < config.cores; c++) for (int i = 0; i < config.levels; i++) if (c == 0 || i < config.levels - 1)
+		{
+			const Cache* l = h.stack[c][i];
+			sum += l->totalCost + l->prefetchStats.lateCycles, hidden += l->pfCost;
+		}
+		if (sum == h.clock.cycles && hidden > 0) continue;
+		printf( "  '%s': %llu cycles on the clock, %llu in the demand costs (%llu for prefetches)\n", setups[s], h.clock.cycles, sum, hidden );
+		ok = false;
+	}
+	return ok;
+}
+
+// picking a victim changes no policy state: a fill the admission filter rejects
+// after Victim must leave the policy as if the miss had never asked
+static bool CheckVictimPeek()
+{
+	bool ok = true;
+	HierarchyConfig config;
+	const int sets = 8, ways = 8;
+	for (int p = EV_LRU; p <= EV_LFUDA; p++)
+	{
+		config.level[0].policy = (EvictionPolicy)p;
+		ReplacementPolicy* a = CreatePolicy( config.level[0].policy ), *b = CreatePolicy( config.level[0].policy );
+		a->Init( config.level[0], sets, ways );
+		b->Init( config.level[0], sets, ways );
+		srand( 1 );
+		for (int i = 0; i < 20000 && ok; i++)
+		{
+			int set = rand() % sets, way = rand() % ways, site = rand() % 4;
+			address tag = (address)(rand() % 64) << 12;
+			a->Access( set, tag, site ), b->Access( set, tag, site );
+			if (rand() % 3 == 0) { a->Touch( set, way ), b->Touch( set, way ); continue; }
+			b->Victim( set ), b->Victim( set );	// rejected fills
+			int v = a->Victim( set );
+			if (b->Victim( set ) != v) { printf( "  policy %i: victim changed by rejected fills (access %i)\n", p, i ); ok = false; }
+			a->Evict( set, v ), b->Evict( set, v );
+			a->Fill( set, v ), b->Fill( set, v );
+		}
+		delete a;
+		delete b;
+	}
+	return ok;
+}
+
+// misses of one policy on a bare sets x ways cache of line numbers
+static int PolicyMisses( EvictionPolicy p, int sets, int ways, const std::vector<uint>& lines )
+{
+	HierarchyConfig config;
+	config.level[0].policy = p;
+	ReplacementPolicy* policy = CreatePolicy( p );
+	policy->Init( config.level[0], sets, ways );
+	std::vector<uint> tags( sets * ways, INVALIDTAG );
+	int misses = 0;
+	for (size_t i = 0; i < lines.size(); i++)
+	{
+		int set = lines[i] % sets, way = 0;
+		uint* t = &tags[set * ways];
+		policy->Access( set, lines[i] << 6, 0 );
+		while (way < ways && t[way] != lines[i]) way++;
+		if (way < ways) { policy->Touch( set, way ); continue; }
+		misses++;
+		way = 0;
+		while (way < ways && t[way] != INVALIDTAG) way++;
+		if (way == ways) way = policy->Victim( set ), policy->Evict( set, way );
+		t[way] = lines[i];
+		policy->Fill( set, way );
+	}
+	delete policy;
+	return misses;
+}
+
+// set dueling follows the better policy: DRRIP misses about as often as SRRIP on
+// working sets that fit but change, and as BRRIP on a loop larger than the cache
+static bool CheckDueling()
+{
+	bool ok = true;
+	static const struct { int sets, ways; } geometry[] = { { 8, 4 }, { 32, 4 }, { 32, 8 }, { 64, 16 }, { 256, 8 } };
+	for (int g = 0; g < (int)(sizeof( geometry ) / sizeof( geometry[0] )); g++)
+	{
+		int sets = geometry[g].sets, ways = geometry[g].ways, lines = sets * ways;
+		std::vector<uint> reuse, loop;
+		// working sets of three quarters of the cache, four passes each, then the next one
+		for (int phase = 0; phase < 100; phase++) for (int i = 0; i < 4 * (lines * 3 / 4); i++) reuse.push_back( phase * lines + i % (lines * 3 / 4) );
+		// one and a half times the cache, over and over
+		for (int i = 0; i < 400 * lines; i++) loop.push_back( i % (lines * 3 / 2) );
+		const std::vector<uint>* streams[] = { &reuse, &loop };
+		const char* names[] = { "reuse", "loop" };
+		for (int s = 0; s < 2; s++)
+		{
+			int srrip = PolicyMisses( EV_SRRIP, sets, ways, *streams[s] ), brrip = PolicyMisses( EV_BRRIP, sets, ways, *streams[s] );
+			int drrip = PolicyMisses( EV_DRRIP, sets, ways, *streams[s] );
+			int best = srrip < brrip ? srrip : brrip, worst = srrip < brrip ? brrip : srrip;
+			if (drrip - best <= (worst - best) / 5) continue;
+			printf( "  %i sets x %i ways, %s: %i misses with srrip, %i with brrip, but %i with drrip\n", sets, ways, names[s], srrip, brrip, drrip );
+			ok = false;
+		}
+	}
+	return ok;
+}
+
+static int RunChecks()
+{
+	static const struct { const char* name; bool (*run)(); } checks[] = {
+		{ "cold misses cause no coherence traffic", CheckColdMisses },
+		{ "compulsory + capacity + conflict = misses", CheckMissClasses },
+		{ "victim selection leaves the policy unchanged", CheckVictimPeek },
+		{ "demand costs add up to the clock with prefetchers", CheckPrefetchCosts },
+		{ "set dueling follows the better policy", CheckDueling },
+	};
+	int failed = 0;
+	for (int i = 0; i < (int)(sizeof( checks ) / sizeof( checks[0] )); i++)
+	{
+		bool ok = checks[i].run();
+		printf( "%-60s %s\n", checks[i].name, ok ? "ok" : "FAILED" );
+		if (!ok) failed++;
+	}
+	printf( "%i of %i checks failed\n", failed, (int)(sizeof( checks ) / sizeof( checks[0] )) );
+	return failed ? 1 : 0;
+}
+
+int main( int argc, char **argv )
+{
+	// pick out the driver options; everything else goes to the cache configuration
+	const char* recordFile = 0, *replayFile = 0, *mrcFile = 0, *sweepFile = 0;
+	int threads = 0, flags = 0;
+	bool hot = false, opt = false, check = false;
+	char** args = new char*[argc];
+	int count = 0;
+	for (int i = 0; i < argc; i++)
+	{
+		if (!strncmp( argv[i], "record=", 7 )) recordFile = argv[i] + 7;
+		else if (!strncmp( argv[i], "replay=", 7 )) replayFile = argv[i] + 7;
+		else if (!strncmp( argv[i], "mrc=", 4 )) mrcFile = argv[i] + 4;
+		else if (!strncmp( argv[i], "sweep=", 6 )) sweepFile = argv[i] + 6;
+		else if (!strncmp( argv[i], "threads=", 8 )) threads = atoi( argv[i] + 8 );
+		else if (!strncmp( argv[i], "pin=", 4 )) flags = atoi( argv[i] + 4 ) ? flags | JOBS_PIN : flags & ~JOBS_PIN;
+		else if (!strncmp( argv[i], "numa=", 5 )) flags = atoi( argv[i] + 5 ) ? flags | JOBS_NUMA : flags & ~JOBS_NUMA;
+		else if (!strncmp( argv[i], "hot=", 4 )) hot = atoi( argv[i] + 4 ) != 0;
+		else if (!strncmp( argv[i], "opt=", 4 )) opt = atoi( argv[i] + 4 ) != 0;
+		else if (!strncmp( argv[i], "check=", 6 )) check = atoi( argv[i] + 6 ) != 0;
+		else args[count++] = argv[i];
+	}
+	if (check)
+	{
+		delete[] args;
+		return RunChecks();
+	}
+	HierarchyConfig config;
+	config.Load( "cache.cfg" );
+	bool valid = config.Parse( count, args ) && config.Validate();
+	delete[] args;
+	if (!valid)
+	{
+		printf( "invalid cache configuration\n" );
+		return 1;
+	}
+	config.Print();
+	if ((mrcFile || sweepFile || opt || UsesOPT( config )) && !replayFile)
+	{
+		printf( "mrc, sweep and OPT need a trace: record one with record=<file>, then use it with replay=<file>\n" );
+		return 1;
+	}
+	if (mrcFile || sweepFile)
+	{
+		if (threads <= 0) threads = (int)std::thread::hardware_concurrency();
+		if (threads > 1 || sweepFile) JobManager::CreateJobManager( threads, flags );
+		if (JobManager::GetJobManager()) JobManager::GetJobManager()->SetHot( hot );
+	}
+	if (mrcFile) return RunMissRatio( config, replayFile, mrcFile );
+	if (sweepFile) return RunSweep( config, replayFile, sweepFile, opt );
+	if (replayFile) return RunReplay( config, replayFile, opt );
+	return RunGame( config, recordFile );
+}
@@ -2,600 +2,1149 @@
 
 // ------------------------------------------------------------------
 // SLOW RAM SIMULATOR
-// Reads and writes full cachelines (64 bytes), like real RAM
-// Has horrible performance, just like real RAM
-// Should not be modified for the assignment.
+// Reads and writes full cachelines (lineSize bytes), like real RAM
+// Has horrible performance, just like real RAM: every transfer
+// advances the simulated clock by the RAM latency (no host-side
+// waiting; simulated time is reported instead).
 // ------------------------------------------------------------------
 
 // constructor
-Memory::Memory( uint size )
+Memory::Memory( uint Size, int LineSize, int Cost, SimClock* Clock, int combine )
 {
-	data = new CacheLine[size / SLOTSIZE];
-	memset( data, 0, size );
-	artificialDelay = true;
+	cost = Cost;
+	clock = Clock;
+	size = Size;
+	lineSize = LineSize;
+	reads = writes = partialWrites = 0;
+	totalCost = 0;
+	pfReads = pfWrites = 0;
+	pfCost = 0;
+	lineShift = 0;
+	while ((1 << lineShift) < lineSize) lineShift++;
+	data = new CacheLine[Size >> lineShift](); // zero-initialized
+	combineEntries = combine;
+	combiner = combine ? new Combiner[combine] : 0;
+	combineUsed = combineOldest = combined = 0;
 }
 
 // destructor
 Memory::~Memory()
 {
-	delete data;
+	delete[] data;
+	delete[] combiner;
 }
 
 // read a cacheline from memory
 CacheLine Memory::READ( address a )
 {
 	// verify that the requested address is the start of a cacheline in memory
-	//_ASSERT( (a & OFFSETMASK) == 0 ); (broken by 16 and 32 bit reads due to smaller offset)
-	// simulate the slowness of4 RAM
-	if (artificialDelay) delay();
+	//_ASSERT( (a & ((1 << lineShift) - 1)) == 0 );
+	CacheLine line = data[a >> lineShift];
+	// pending partial writes to this line are newer than RAM; a complete one saves the read
+	Combiner* c = FindCombiner( a );
+	unsigned long long full = lineSize == 64 ? ~0ULL : (1ULL << lineSize) - 1;
+	if (c) for (int i = 0; i < lineSize; i++) if (c->valid & (1ULL << i)) line.value[i] = c->value[i];
+	if (c && c->valid == full) return line;
+	// simulate the slowness of RAM
+	Charge( reads, pfReads );
 	// return the requested data
-	return data[a / (SLOTSIZE/4)]; //use 4 times less addresses to scale for up to 32-bit read and writes
+	return line;
 }
 
 // write a cacheline to memory
 void Memory::WRITE( address a, CacheLine& line )
 {
 	// verify that the requested address is the start of a cacheline in memory
-	//_ASSERT( (a & OFFSETMASK) == 0 ); (broken by 16 and bit writes due to smaller offset)
+	//_ASSERT( (a & ((1 << lineShift) - 1)) == 0 );
+	// the whole line replaces whatever was waiting to be combined
+	Combiner* c = FindCombiner( a );
+	if (c) c->valid = 0;
 	// simulate the slowness of RAM
-	if (artificialDelay) delay();
+	Charge( writes, pfWrites );
 	// write the supplied data to memory
-	data[a / (SLOTSIZE/4)] = line; //use 4 times less addresses to scale for up to 32-bit read and writes
+	data[a >> lineShift] = line;
+}
+
+// write part of a cacheline: merged into the write-combining buffer if there
+// is one, otherwise straight to RAM (a masked write costs as much as a full one)
+void Memory::WRITEBYTES( address a, const byte* bytes, int count )
+{
+	address tag = a & ~(address)(lineSize - 1);
+	int offset = a - tag;
+	if (!combineEntries)
+	{
+		Charge( writes, pfWrites ), partialWrites++;
+		memcpy( data[a >> lineShift].value + offset, bytes, count );
+		return;
+	}
+	Combiner* c = FindCombiner( tag );
+	if (c) combined++; else
+	{
+		// claim a free entry, or drain the oldest
+		if (combineUsed < combineEntries) c = &combiner[combineUsed++]; else
+		{
+			c = &combiner[combineOldest];
+			combineOldest = (combineOldest + 1) % combineEntries;
+			Drain( *c );
+		}
+		c->tag = tag, c->valid = 0;
+	}
+	memcpy( c->value + offset, bytes, count );
+	c->valid |= (count == 64 ? ~0ULL : (1ULL << count) - 1) << offset;
+}
+
+// advance simulated time by the RAM latency, and count the transfer
+void Memory::Charge( int& count, int& pfCount )
+{
+	clock->cycles += cost;
+	if (clock->background) pfCost += cost, pfCount++; else totalCost += cost, count++;
+}
+
+Memory::Combiner* Memory::FindCombiner( address tag )
+{
+	for (int i = 0; i < combineUsed; i++) if (combiner[i].tag == tag && combiner[i].valid) return &combiner[i];
+	return 0;
+}
+
+// one RAM write for all the bytes an entry collected
+void Memory::Drain( Combiner& c )
+{
+	if (!c.valid) return;
+	unsigned long long full = lineSize == 64 ? ~0ULL : (1ULL << lineSize) - 1;
+	byte* line = data[c.tag >> lineShift].value;
+	for (int i = 0; i < lineSize; i++) if (c.valid & (1ULL << i)) line[i] = c.value[i];
+	Charge( writes, pfWrites );
+	if (c.valid != full) partialWrites++;
+	c.valid = 0;
 }
 
 // ------------------------------------------------------------------
 // CACHE SIMULATOR
-// Currently passes all requests directly to simulated RAM.
-// TODO (for a passing grade (6)):
-// 1. Build a fully associative cache to speed up requests
-// 2. Build a direct mapped cache to improve on the fully associative
-//    cache
-// 3. Build a N-way set associative cache to improve on the direct
-//    mapped cache
-// Optional (1 extra point per item, up to a 10):
-// 4. Experiment with various eviction policies
-// 5. Build a cache hierarchy
-// 6. Implement functions for reading/writing 16 and 32-bit values
-// 7. Provide detailed statistics on cache performance
+// The set lookup, fill and eviction live in CacheT (cache.h); this
+// is the part shared by all cache implementations.
 // ------------------------------------------------------------------
 
 // constructor
-Cache::Cache(Memory* mem, int size, int Nway, int SetMask, int Cost, Cache* c)
+// set, offset and tag masks are derived from the configured geometry
+// (sizes must be powers of two; see HierarchyConfig::Validate)
+Cache::Cache(Memory* mem, const CacheConfig& config, int LineSize, Cache* c)
 {
-	setMask = SetMask;
-	nway = Nway;
-	cost = Cost;
-	slot = new CacheLine*[size / SLOTSIZE / nway];
-	for (int i = 0; i < size / SLOTSIZE / nway; i++)
-	{
-		slot[i] = new CacheLine[nway];
-	}
+	nway = config.nway;
+	cost = config.cost;
+	writeThrough = config.writeThrough;
+	writeAllocate = config.writeAllocate;
+	inclusive = config.inclusion == IN_INCLUSIVE;
+	exclusive = config.inclusion == IN_EXCLUSIVE;
+	lineSize = LineSize;
+	nsets = config.size / lineSize / nway;
+	setShift = 0;
+	while ((1 << setShift) < lineSize) setShift++;
+	offsetMask = lineSize - 1;
+	addressMask = ~(address)offsetMask;
+	setMask = (nsets - 1) << setShift;
+	wayMask = nway == 32 ? 0xFFFFFFFF : (1u << nway) - 1;
+	tagStride = nway < 4 ? 4 : nway;
+	tags = (uint*)MALLOC64( nsets * tagStride * sizeof( uint ) );
+	for (int i = 0; i < nsets * tagStride; i++) tags[i] = INVALIDTAG;
+	dirty = new uint[nsets]();
+	data = (byte*)MALLOC64( nsets * nway * lineSize );
 	memory = mem;
+	clock = mem->clock;
 	nextCache = c;
-	hits = misses = totalCost = cum_hits = cum_misses = 0;
+	for (Cache* b = c; b; b = b->nextCache) b->above.push_back( this );
+	exclusiveBelow = c && c->exclusive;
+	hits = misses = cum_hits = cum_misses = 0;
+	pfHits = pfMisses = 0;
+	insertions = 0;
+	inserting = false;
+	invalidations = 0;
+	totalCost = pfCost = 0;
+	site = 0;
+	memset( &prefetchStats, 0, sizeof( prefetchStats ) );
+	prefetcher = CreatePrefetcher( config, lineSize );
+	prefetched = 0, ready = 0, pollution = 0;
+	victimCache = config.victims ? new VictimCache( config.victims, lineSize ) : 0;
+	admission = config.admission ? new TinyLFU( nsets * nway ) : 0;
+	classifier = 0;
+	coherence = 0, core = 0;
+	oracle = 0;
+	if (prefetcher)
+	{
+		prefetched = new uint[nsets]();
+		ready = new unsigned long long[nsets * nway]();
+		pollution = new uint[(mem->size / lineSize + 31) / 32]();
+	}
 }
 
 // destructor
 Cache::~Cache()
 {
-	delete slot;
+	FREE64( tags );
+	FREE64( data );
+	delete[] dirty;
+	delete prefetcher;
+	delete[] prefetched;
+	delete[] ready;
+	delete[] pollution;
+	delete victimCache;
+	delete admission;
+	delete classifier;
 }
 
-// read a single byte from cache
-byte Cache::READ( address a )
+// read a line from the next cache if exists, otherwise from memory
+bool Cache::FETCH( address a, byte* line )
 {
-	int n = (a & setMask) >> 6; //bitshift offset bits (always 64 with slotsize 64)
-	for (int i = 0; i < nway; i++)
+	// another core may own a newer copy
+	if (coherence && coherence->Read( core, a, line )) return false;
+	if (nextCache)
 	{
-			slot[n][i].age++; //LRU
-		if ((slot[n][i].tag & ADDRESSMASK) == (a & ADDRESSMASK))
-		{
-			totalCost += cost; hits++;
-			slot[n][i].age = 0; //LRU
-			slot[n][i].n_uses++; //LFU
-			return slot[n][i].value[a & OFFSETMASK];
-		}
+		nextCache->site = site;
+		// an exclusive level hands the line over, dirty or not
+		if (nextCache->exclusive) return nextCache->TAKE( a, line );
+		nextCache->READLINE( a, line );
 	}
-
-	// Read from next cache if exists, otherwise from memory
-	CacheLine line;
-	byte returnValue;
-	if (nextCache)
+	else
 	{
-		returnValue = nextCache->READ(a);
+		CacheLine l = memory->READ( a );
+		memcpy( line, l.value, lineSize );
 	}
-	else //read from memory
+	return false;
+}
+
+// write a dirty line back to the next cache if exists, otherwise to memory;
+// an exclusive next level takes clean victims as well
+void Cache::WRITEBACK( address a, const byte* line, bool isDirty )
+{
+	if (exclusiveBelow) nextCache->INSERT( a, line, isDirty );
+	else if (nextCache) nextCache->WRITELINE( a, line );
+	else
 	{
-		line = memory->READ(a & ADDRESSMASK);
-		returnValue = line.value[a & OFFSETMASK];
-		totalCost += RAMACCESSCOST;
+		CacheLine l;
+		memcpy( l.value, line, lineSize );
+		memory->WRITE( a, l );
 	}
+}
+
+// ------------------------------------------------------------------
+// VICTIM CACHE
+// ------------------------------------------------------------------
+
+VictimCache::VictimCache( int Entries, int LineSize )
+{
+	entries = Entries, lineSize = LineSize;
+	tags = new address[entries];
+	dirty = new bool[entries]();
+	age = new uint[entries]();
+	data = new byte[entries * lineSize];
+	for (int i = 0; i < entries; i++) tags[i] = INVALIDTAG;
+	probes = hits = 0;
+	time = 0;
+}
+
+VictimCache::~VictimCache()
+{
+	delete[] tags;
+	delete[] dirty;
+	delete[] age;
+	delete[] data;
+}
 
-	WRITE(a, returnValue);
-	misses++;
-	return returnValue;
+int VictimCache::Find( address tag )
+{
+	for (int i = 0; i < entries; i++) if (tags[i] == tag) return i;
+	return -1;
 }
 
-//read an entire cacheline from cache
-CacheLine Cache::READLINE(address a, int mask)
+const byte* VictimCache::Take( address tag, bool& isDirty )
 {
-	int n = (a & setMask) >> 6;
-	for (int i = 0; i < nway; i++)
+	probes++;
+	int i = Find( tag );
+	if (i < 0) return 0;
+	hits++;
+	memcpy( spare, data + i * lineSize, lineSize );
+	isDirty = dirty[i];
+	tags[i] = INVALIDTAG;
+	return spare;
+}
+
+const byte* VictimCache::Insert( address tag, const byte* line, bool isDirty, address& outTag, bool& outDirty )
+{
+	// a free entry, or else the oldest
+	int v = 0;
+	for (int i = 0; i < entries; i++)
 	{
-		slot[n][i].age++; //LRU
-		if ((slot[n][i].tag & mask) == (a & mask))
-		{
-			totalCost += cost; hits++;
-			slot[n][i].age = 0; //LRU
-			slot[n][i].n_uses++; //LFU
-			return slot[n][i];
-		}
+		if (tags[i] == INVALIDTAG) { v = i; break; }
+		if (age[i] < age[v]) v = i;
+	}
+	const byte* out = 0;
+	if (tags[v] != INVALIDTAG)
+	{
+		memcpy( spare, data + v * lineSize, lineSize );
+		outTag = tags[v], outDirty = dirty[v];
+		out = spare;
 	}
+	memcpy( data + v * lineSize, line, lineSize );
+	tags[v] = tag, dirty[v] = isDirty, age[v] = ++time;
+	return out;
+}
 
-	// Read from next cache if exists, otherwise from memory
-	CacheLine line;
-	if (nextCache)
+bool VictimCache::Invalidate( address tag, byte* line, bool& isDirty )
+{
+	int i = Find( tag );
+	if (i < 0) return false;
+	isDirty = dirty[i];
+	if (isDirty) memcpy( line, data + i * lineSize, lineSize );
+	tags[i] = INVALIDTAG;
+	return true;
+}
+
+bool VictimCache::Peek( address tag, byte* line )
+{
+	int i = Find( tag );
+	if (i < 0 || !dirty[i]) return false;
+	memcpy( line, data + i * lineSize, lineSize );
+	return true;
+}
+
+void VictimCache::Clean( address tag, const byte* line )
+{
+	int i = Find( tag );
+	if (i < 0) return;
+	memcpy( data + i * lineSize, line, lineSize );
+	dirty[i] = false;
+}
+
+// ------------------------------------------------------------------
+// ADMISSION (see TinyLFU in cache.h)
+// ------------------------------------------------------------------
+
+TinyLFU::TinyLFU( int lines )
+{
+	for (width = 16; width < (uint)lines; width <<= 1);
+	counters = new byte[SKETCHDEPTH * width]();
+	sample = SKETCHSAMPLE * lines;
+	additions = 0;
+	candidates = rejected = halvings = 0;
+}
+
+// an independent hash per row
+uint TinyLFU::Slot( address tag, int row ) const
+{
+	static const uint seed[SKETCHDEPTH] = { 0x9e3779b1, 0x85ebca77, 0xc2b2ae3d, 0x27d4eb2f };
+	uint h = (uint)tag * seed[row];
+	h ^= h >> 15, h *= 0x2c1b3c6d, h ^= h >> 13;
+	return row * width + (h & (width - 1));
+}
+
+void TinyLFU::Record( address tag )
+{
+	for (int r = 0; r < SKETCHDEPTH; r++)
 	{
-		line = nextCache->READLINE(a, mask);
+		byte& n = counters[Slot( tag, r )];
+		if (n < SKETCHMAX) n++;
 	}
-	else
+	if (++additions < sample) return;
+	// age: halve every counter
+	for (uint i = 0; i < SKETCHDEPTH * width; i++) counters[i] >>= 1;
+	additions /= 2, halvings++;
+}
+
+// count-min: collisions only add, so the smallest counter is the best estimate
+int TinyLFU::Estimate( address tag )
+{
+	int n = SKETCHMAX;
+	for (int r = 0; r < SKETCHDEPTH; r++)
 	{
-		line = memory->READ(a & mask);
-		totalCost += RAMACCESSCOST;
+		int c = counters[Slot( tag, r )];
+		if (c < n) n = c;
 	}
+	return n;
+}
 
-	WRITELINE(a, line, mask);
-	misses++;
-	return line;
+bool TinyLFU::Admit( address tag, address victim )
+{
+	candidates++;
+	if (Estimate( tag ) > Estimate( victim )) return true;
+	rejected++;
+	return false;
 }
 
-// write a single byte to cache
-void Cache::WRITE(address a, byte value)
+// ------------------------------------------------------------------
+// MISS CLASSIFICATION (see MissClassifier in cache.h)
+// ------------------------------------------------------------------
+
+MissClassifier::MissClassifier( int _Lines, int _LineSize, int memorySize )
+{
+	lines = _Lines, lineSize = _LineSize;
+	touched = new uint[(memorySize / lineSize + 31) / 32]();
+	tags = new address[lines];
+	prev = new int[lines], next = new int[lines];
+	head = tail = -1, used = 0;
+	compulsory = capacity = conflict = 0;
+	cum_compulsory = cum_capacity = cum_conflict = 0;
+}
+
+MissClassifier::~MissClassifier()
 {
-	int n = (a & setMask) >> 6;
+	delete[] touched;
+	delete[] tags;
+	delete[] prev;
+	delete[] next;
+}
 
-	for (int i = 0; i < nway; i++)
-		slot[n][i].age++; //LRU
+void MissClassifier::Access( address tag, bool hit )
+{
+	bool shadowHit = Shadow( tag );
+	uint line = tag / lineSize, bit = 1u << (line & 31);
+	bool first = !(touched[line >> 5] & bit);
+	touched[line >> 5] |= bit;
+	if (hit) return;
+	if (first) compulsory++;
+	else if (!shadowHit) capacity++;
+	else conflict++;
+}
 
-	for (int i = 0; i < nway; i++)
+bool MissClassifier::Shadow( address tag )
+{
+	std::unordered_map<address, int>::iterator it = where.find( tag );
+	if (it != where.end())
 	{
-		if (slot[n][i].valid){
-			if ((slot[n][i].tag & ADDRESSMASK) == (a & ADDRESSMASK))
-			{
-				slot[n][i].value[a & OFFSETMASK] = value;
-				slot[n][i].dirty = true;
-				totalCost += cost; hits++;
-				slot[n][i].age = 0; //LRU
-				slot[n][i].n_uses++; //LFU
-				return;
-			}
-		}
+		int i = it->second;
+		if (i != head) Unlink( i ), Link( i );
+		return true;
 	}
+	int i;
+	if (used < lines) i = used++; else
+	{
+		// replace the least recently used line
+		i = tail;
+		where.erase( tags[i] );
+		Unlink( i );
+	}
+	tags[i] = tag;
+	where[tag] = i;
+	Link( i );
+	return false;
+}
 
-	// request a full line from memory/cache
-	CacheLine line;
-	if (nextCache)
-		line = nextCache->READLINE(a & ADDRESSMASK, ADDRESSMASK);
-	else
-		line = memory->READ(a & ADDRESSMASK);
+void MissClassifier::Unlink( int i )
+{
+	if (prev[i] >= 0) next[prev[i]] = next[i]; else head = next[i];
+	if (next[i] >= 0) prev[next[i]] = prev[i]; else tail = prev[i];
+}
+
+void MissClassifier::Link( int i )
+{
+	prev[i] = -1, next[i] = head;
+	if (head >= 0) prev[head] = i; else tail = i;
+	head = i;
+}
+
+// ------------------------------------------------------------------
+// INCLUSION
+// Inclusive: a line leaving this level leaves every level above too;
+// dirty copies up there are newer, so their data goes into the victim
+// (L1 last: its copy is the newest). Exclusive: lines come in only as
+// victims of the level above (INSERT), and leave again when the level
+// above misses on them (TAKE); misses pass straight through, without
+// a fill here. NINE levels do neither.
+// ------------------------------------------------------------------
 
-	//if invalid, write entire line
-	for (int i = 0; i < nway; i++)
+void Cache::EVICT( int set, int way, bool byPrefetch )
+{
+	if (prefetched) Evicted( set, way, byPrefetch );
+	address tag = tags[set * tagStride + way];
+	byte* line = data + (set * nway + way) * lineSize;
+	if (inclusive) for (size_t i = 0; i < above.size(); i++) if (above[i]->INVALIDATE( tag, line )) dirty[set] |= 1 << way;
+	bool isDirty = (dirty[set] >> way) & 1;
+	// empty until the caller fills it, so back-invalidations from below cannot match it meanwhile
+	tags[set * tagStride + way] = INVALIDTAG;
+	dirty[set] &= ~(1 << way);
+	if (!victimCache)
 	{
-		if (!slot[n][i].valid){
-			slot[n][i].tag = a;
+		if (isDirty || exclusiveBelow) WRITEBACK( tag, line, isDirty );
+		return;
+	}
+	// into the victim cache; what leaves the level is the oldest victim, if that is full
+	address outTag;
+	bool outDirty;
+	const byte* out = victimCache->Insert( tag, line, isDirty, outTag, outDirty );
+	if (out && (outDirty || exclusiveBelow)) WRITEBACK( outTag, out, outDirty );
+}
 
-			for (int t = 0; t < SLOTSIZE; t++)
-				slot[n][i].value[t] = line.value[t];
-			slot[n][i].value[a & OFFSETMASK] = value;
+const byte* Cache::RECALL( address a, bool& isDirty )
+{
+	Charge( VICTIMCOST );
+	return victimCache->Take( a, isDirty );
+}
 
-			slot[n][i].valid = true;
-			slot[n][i].dirty = true;
-			totalCost += cost; hits++;
-			slot[n][i].age = 0; //LRU
-			slot[n][i].n_uses++; //LFU
-			return;
-		}
+bool Cache::INVALIDATE( address a, byte* line )
+{
+	int n = (a & setMask) >> setShift;
+	uint* t = tags + n * tagStride;
+	uint match = MatchTags( t, tagStride, a & addressMask ) & wayMask;
+	if (!match)
+	{
+		bool wasDirty = false;
+		if (victimCache && victimCache->Invalidate( a & addressMask, line, wasDirty )) invalidations++;
+		return wasDirty;
 	}
+	int i = LowestBit( match );
+	if (prefetched) Evicted( n, i, false );
+	t[i] = INVALIDTAG;
+	invalidations++;
+	bool wasDirty = (dirty[n] >> i) & 1;
+	dirty[n] &= ~(1 << i);
+	if (wasDirty) memcpy( line, data + (n * nway + i) * lineSize, lineSize );
+	return wasDirty;
+}
 
-	int z = EVICTION(n);
+bool Cache::PEEK( address a, byte* line )
+{
+	int n = (a & setMask) >> setShift;
+	uint match = MatchTags( tags + n * tagStride, tagStride, a & addressMask ) & wayMask;
+	if (!match) return victimCache && victimCache->Peek( a & addressMask, line );
+	int i = LowestBit( match );
+	if (!((dirty[n] >> i) & 1)) return false;
+	memcpy( line, data + (n * nway + i) * lineSize, lineSize );
+	return true;
+}
 
-	if (slot[n][z].dirty)
+void Cache::CLEAN( address a, const byte* line )
+{
+	int n = (a & setMask) >> setShift;
+	uint match = MatchTags( tags + n * tagStride, tagStride, a & addressMask ) & wayMask;
+	if (!match)
 	{
-		// write the line back to memory or next cache if dirty
-		if (nextCache)
-		{
-			nextCache->WRITELINE(slot[n][z].tag & ADDRESSMASK, slot[n][z], ADDRESSMASK);
-		}
-		else
-		{
-			memory->WRITE(slot[n][z].tag & ADDRESSMASK, slot[n][z]);
-			totalCost += RAMACCESSCOST;
-		}
+		if (victimCache) victimCache->Clean( a & addressMask, line );
+		return;
 	}
+	int i = LowestBit( match );
+	memcpy( data + (n * nway + i) * lineSize, line, lineSize );
+	dirty[n] &= ~(1 << i);
+}
 
-	//copy entire cacheline
-	for (int t = 0; t < SLOTSIZE; t++)
-		slot[n][z].value[t] = line.value[t];
-	slot[n][z].value[a & OFFSETMASK] = value;
-	slot[n][z].tag = a;
-	slot[n][z].valid = true;
-	slot[n][z].dirty = true;
-	misses++;
-	slot[n][z].age = 0; //LRU
-	slot[n][z].n_uses++; //LFU
-	return;
-}
-
-//write an entire line to cache
-void Cache::WRITELINE(address a, CacheLine& value, int mask)
-{
-	int n = (a & setMask) >> 6;
-	for (int i = 0; i < nway; i++)
-		slot[n][i].age++; //LRU
-
-	for (int i = 0; i < nway; i++)
-	{
-		if (slot[n][i].valid){
-			if ((slot[n][i].tag & mask) == (a & mask))
-			{
-				for (int t = 0; t < SLOTSIZE; t++)
-					slot[n][i].value[t] = value.value[t];
-				slot[n][i].dirty = true;
-				totalCost += cost; hits++;
-				slot[n][i].age = 0; //LRU
-				slot[n][i].n_uses++; //LFU
-				return;
-			}
-		}
+bool Cache::TAKE( address a, byte* line )
+{
+	Charge();
+	int n = (a & setMask) >> setShift;
+	uint match = MatchTags( tags + n * tagStride, tagStride, a & addressMask ) & wayMask;
+	// every access of an exclusive level from above comes through here
+	if (classifier && !clock->background) classifier->Access( a & addressMask, match != 0 );
+	if (!match)
+	{
+		Count( false );
+		bool wasDirty = false;
+		const byte* recalled = victimCache ? RECALL( a & addressMask, wasDirty ) : 0;
+		if (!recalled) return FETCH( a, line );
+		memcpy( line, recalled, lineSize );
+		return wasDirty;
 	}
+	Count( true );
+	int i = LowestBit( match );
+	memcpy( line, data + (n * nway + i) * lineSize, lineSize );
+	tags[n * tagStride + i] = INVALIDTAG;
+	bool wasDirty = (dirty[n] >> i) & 1;
+	dirty[n] &= ~(1 << i);
+	return wasDirty;
+}
+
+void Cache::INSERT( address a, const byte* line, bool isDirty )
+{
+	// a fill, not a lookup: ACCESS only places the line (and evicts for it)
+	inserting = true;
+	if (isDirty) WRITELINE( a, line );
+	else memcpy( ACCESS( a & addressMask, false, true ), line, lineSize );
+	inserting = false;
+}
+
+// ------------------------------------------------------------------
+// OPT
+// ------------------------------------------------------------------
 
-	for (int i = 0; i < nway; i++)
+int Cache::Furthest( int set )
+{
+	const uint* t = tags + set * tagStride;
+	int v = 0;
+	uint furthest = oracle->Next( t[0] );
+	for (int i = 1; i < nway && furthest != NEVER; i++)
 	{
-		if (!slot[n][i].valid){
-			for (int t = 0; t < SLOTSIZE; t++)
-				slot[n][i].value[t] = value.value[t];
-			slot[n][i].tag = a;
-			slot[n][i].valid = true;
-			slot[n][i].dirty = true;
-			totalCost += cost; hits++;
-			slot[n][i].age = 0; //LRU
-			slot[n][i].n_uses++; //LFU
-			return;
-		}
+		uint next = oracle->Next( t[i] );
+		if (next > furthest) furthest = next, v = i;
 	}
+	return v;
+}
 
-	int z = EVICTION(n);
+// ------------------------------------------------------------------
+// PREFETCH ACCOUNTING
+// The prefetched mask marks lines filled by the prefetcher that no
+// demand access has used yet: their first use counts as useful (and
+// as late if the fill was still in flight), their eviction as unused.
+// Lines evicted by prefetch fills are marked in a bitmap of all RAM
+// lines; a later demand miss on one of them counts as pollution.
+// ------------------------------------------------------------------
 
-	// request a full line from memory/cache
-	CacheLine line;
-	if (nextCache)
-		line = nextCache->READLINE(a & mask, mask);
-	else
-		line = memory->READ(a & mask);
+bool Cache::NextPrefetch( address& a )
+{
+	while (prefetcher->Pop( a )) if (a < memory->size) return true; // drop lines past the end of RAM
+	return false;
+}
 
-	if (slot[n][z].dirty)
+void Cache::Observe( address a, bool fullLine, int set, int way )
+{
+	bool first = false;
+	if (way >= 0 && (prefetched[set] & (1 << way)))
 	{
-		// write the line back to memory or next cache
-		if (nextCache)
+		prefetched[set] &= ~(1 << way), first = true;
+		prefetchStats.useful++;
+		unsigned long long done = ready[set * nway + way];
+		if (done > clock->cycles)
 		{
-			nextCache->WRITELINE(slot[n][z].tag & mask, slot[n][z], mask);
-		}
-		else
-		{
-			memory->WRITE(slot[n][z].tag & mask, slot[n][z]);
-			totalCost += RAMACCESSCOST;
+			// wait for the prefetch to complete (a prefetch fill from above waits too, but off the clock)
+			if (!clock->background) prefetchStats.late++, prefetchStats.lateCycles += done - clock->cycles;
+			clock->cycles = done;
 		}
 	}
+	if (way < 0)
+	{
+		uint bit = a / lineSize;
+		if (pollution[bit >> 5] & (1 << (bit & 31))) prefetchStats.polluting++, pollution[bit >> 5] &= ~(1 << (bit & 31));
+	}
+	// lines written back from the level above are not demand accesses
+	if (!fullLine) prefetcher->Train( a, site, way >= 0, first );
+}
 
-	//copy entire cacheline
-	for (int t = 0; t < SLOTSIZE; t++)
-		slot[n][z].value[t] = value.value[t];
-	slot[n][z].tag = a;
-	slot[n][z].valid = true;
-	slot[n][z].dirty = true;
-	misses++;
-	slot[n][z].age = 0; //LRU
-	slot[n][z].n_uses++; //LFU
-	return;
+void Cache::Evicted( int set, int way, bool byPrefetch )
+{
+	if (prefetched[set] & (1 << way)) prefetched[set] &= ~(1 << way), prefetchStats.unused++;
+	else if (byPrefetch)
+	{
+		uint bit = tags[set * tagStride + way] / lineSize;
+		pollution[bit >> 5] |= 1 << (bit & 31);
+	}
 }
 
-int Cache::EVICTION(int n)
+void Cache::Prefetched( int set, int way, unsigned long long issue )
 {
-	int i;
-	#ifdef EV_RANDOM
-		i = rand() % 4;
-	#endif
+	// the fill ran on the simulated clock to find its latency; roll the clock back
+	ready[set * nway + way] = clock->cycles;
+	clock->cycles = issue;
+	prefetched[set] |= 1 << way;
+	uint bit = tags[set * tagStride + way] / lineSize;
+	pollution[bit >> 5] &= ~(1 << (bit & 31));
+	prefetchStats.issued++;
+}
 
-	#ifdef EV_LRU
-		int max = 0;
-		for (int t = 0; t < nway; t++)
-		{
-			if (slot[n][t].age > max)
-			{
-				max = slot[n][t].age;
-				i = t;
-			}
-		}
-	#endif
+// write bytes to the next level, or to RAM
+void Cache::FORWARD( address a, const byte* bytes, int size )
+{
+	if (nextCache) nextCache->site = site, nextCache->WRITEBYTES( a, bytes, size );
+	else if (size == lineSize)
+	{
+		CacheLine l;
+		memcpy( l.value, bytes, lineSize );
+		memory->WRITE( a, l );
+	}
+	else memory->WRITEBYTES( a, bytes, size );
+}
 
-	#ifdef EV_MRU
-		int min = 999999;
-		for (int t = 0; t < nway; t++)
-		{
-			if (slot[n][t].age < min)
-			{
-				min = slot[n][t].age;
-				i = t;
-			}
-		}
-	#endif
+// read an entire cacheline from cache
+void Cache::READLINE( address a, byte* line )
+{
+	memcpy( line, ACCESS( a & addressMask, false ), lineSize );
+}
 
-	#ifdef EV_LFU
-		int min = 999999;
-		for (int t = 0; t < nway; t++)
-		{
-			if (slot[n][t].n_uses < min)
-			{
-				min = slot[n][t].n_uses;
-				i = t;
-			}
-		}
-	#endif
-#ifdef EV_CONST
-		{
-			i = 0;
-		}
-#endif
+// write an entire cacheline to cache (no fetch needed on a miss: the whole line is replaced)
+void Cache::WRITELINE( address a, const byte* line )
+{
+	WRITEBYTES( a & addressMask, line, lineSize );
+}
 
-	return i;
+// write part of a line (a whole line when size == lineSize); a partial write
+// miss fetches the rest of the line first, if this level allocates on writes
+void Cache::WRITEBYTES( address a, const byte* bytes, int size )
+{
+	byte* line = ACCESS( a, true, size == lineSize );
+	memcpy( line + (a & offsetMask), bytes, size );
+	Written( a, line, size );
+}
 
+// read a single byte from cache
+byte Cache::READ( address a )
+{
+	return ACCESS( a, false )[a & offsetMask];
+}
+
+// write a single byte to cache
+void Cache::WRITE( address a, byte value )
+{
+	byte* line = ACCESS( a, true );
+	line[a & offsetMask] = value;
+	Written( a, line, 1 );
 }
 
 //read 16-bit data type from cache
-__int16 Cache::READ16(address a){
-	int n = (a & setMask) >> 6; //bitshift offset bits
-	int offset = (a & OFFSETMASK16) * 2;
-	for (int i = 0; i < nway; i++)
+__int16 Cache::READ16( address a )
+{
+	byte* v = ACCESS( a, false ) + (a & offsetMask);
+	return (__int16)((v[0] << 8) | v[1]);
+}
+
+// write 16-bit data type to cache
+void Cache::WRITE16( address a, __int16 value )
+{
+	byte* line = ACCESS( a, true ), *v = line + (a & offsetMask);
+	//write two bytes
+	v[0] = value >> 8;
+	v[1] = value & 0xFF;
+	Written( a, line, 2 );
+}
+
+//read 32-bit data type from cache
+__int32 Cache::READ32( address a )
+{
+	byte* v = ACCESS( a, false ) + (a & offsetMask);
+	return (__int32)((v[0] << 24) | (v[1] << 16) | (v[2] << 8) | v[3]);
+}
+
+// write 32-bit data type to cache
+void Cache::WRITE32( address a, __int32 value )
+{
+	byte* line = ACCESS( a, true ), *v = line + (a & offsetMask);
+	//write four bytes
+	v[0] = value >> 24;
+	v[1] = (value >> 16) & 0xFF;
+	v[2] = (value >> 8) & 0xFF;
+	v[3] = value & 0xFF;
+	Written( a, line, 4 );
+}
+
+// ------------------------------------------------------------------
+// CACHE AND POLICY FACTORIES
+// Configurations listed in CreateCache get a CacheT with compile-time
+// geometry and a directly called policy; anything else gets the
+// runtime-configured CacheT<0, 0, 0, AnyPolicy>.
+// ------------------------------------------------------------------
+
+ReplacementPolicy* CreatePolicy( EvictionPolicy policy )
+{
+	switch (policy)
 	{
-		slot[n][i].age++; //LRU
-		if ((slot[n][i].tag & ADDRESSMASK16) == (a & ADDRESSMASK16))
-		{
-			totalCost += cost; hits++;
-			slot[n][i].age = 0; //LRU
-			slot[n][i].n_uses++; //LFU
-			return (__int16)(((__int16)slot[n][i].value[offset] << 8) | (__int16)slot[n][i].value[offset + 1]);
-		}
+	case EV_MRU: return new MRUPolicy();
+	case EV_LFU: return new LFUPolicy();
+	case EV_RANDOM: return new RandomPolicy();
+	case EV_CONST: return new ConstPolicy();
+	case EV_PLRU: return new PLRUPolicy();
+	case EV_SRRIP: return new SRRIPPolicy();
+	case EV_BRRIP: return new BRRIPPolicy();
+	case EV_DRRIP: return new DRRIPPolicy();
+	case EV_DIP: return new DIPPolicy();
+	case EV_HAWKEYE: return new HawkeyePolicy();
+	case EV_LFUDA: return new LFUDAPolicy();
+	default: return new LRUPolicy();
 	}
+}
 
-	// Read from next cache if exists, otherwise from memory
-	CacheLine line;
-	__int16 returnValue;
-	if (nextCache)
+#define SPECIALIZE( S, W, L, E, P ) \
+	if (config.size == S && config.nway == W && lineSize == L && config.policy == E) return new CacheT<S, W, L, P>( mem, config, lineSize, c );
+
+Cache* CreateCache( Memory* mem, const CacheConfig& config, int lineSize, Cache* c, bool specialize )
+{
+	if (specialize)
 	{
-		returnValue = nextCache->READ16(a);
+		// the default hierarchy (see cache.cfg)
+		SPECIALIZE( 8192, 4, 64, EV_LRU, LRUPolicy );
+		SPECIALIZE( 16384, 8, 64, EV_LRU, LRUPolicy );
+		SPECIALIZE( 65536, 16, 64, EV_LRU, LRUPolicy );
+		SPECIALIZE( 8192, 4, 64, EV_PLRU, PLRUPolicy );
+		SPECIALIZE( 16384, 8, 64, EV_PLRU, PLRUPolicy );
+		SPECIALIZE( 65536, 16, 64, EV_PLRU, PLRUPolicy );
+		SPECIALIZE( 65536, 16, 64, EV_DRRIP, DRRIPPolicy );
+		// common L1 alternatives
+		SPECIALIZE( 8192, 8, 64, EV_LRU, LRUPolicy );
+		SPECIALIZE( 16384, 4, 64, EV_LRU, LRUPolicy );
+		SPECIALIZE( 32768, 8, 64, EV_LRU, LRUPolicy );
 	}
-	else //read from memory
+	return new CacheT<0, 0, 0, AnyPolicy>( mem, config, lineSize, c );
+}
+
+// ------------------------------------------------------------------
+// HIERARCHY CONFIGURATION
+// Loaded at startup from a file and/or the command line, so design
+// points can be evaluated without rebuilding. Format, one per line:
+//   levels = 3        linesize = 64     datasize = 8     ramcost = 110
+//   frequency = 3.0 (GHz, for reporting simulated time)
+//   combine = 4 (write-combining buffer entries in front of RAM; 0: none)
+//   specialize = 1 (use compile-time specialized caches where available)
+//   classify = 1 (split every level's misses into compulsory, capacity and conflict)
+//   l1.size = 8192    l1.ways = 4       l1.cost = 8      l1.policy = lru
+//   l1.write = back (or through)          l1.allocate = 1 (0: write around on misses)
+//   l2.inclusion = nine (or inclusive, exclusive: relative to the levels above)
+//   l1.victims = 8 (entries in a victim cache next to the level; 0: none)
+//   l3.admission = 1 (TinyLFU: a miss replaces only a less frequently used line)
+//   cores = 4 (private L1..Ln-1 per core, shared Ln)   coherence = mesi (or moesi)
+//   snoopcost = 40 (cycles per coherence transaction that involves other cores)
+// Lines starting with '#' are comments.
+// ------------------------------------------------------------------
+
+static const char* policyName[] = { "lru", "mru", "lfu", "random", "const", "plru", "srrip", "brrip", "drrip", "dip", "opt", "hawkeye", "lfuda" };
+static const char* prefetchName[] = { "none", "next", "stride", "region", "stream" };
+static const char* inclusionName[] = { "nine", "inclusive", "exclusive" };
+static const char* coherenceName[] = { "mesi", "moesi" };
+
+static bool IsPowerOfTwo( int x ) { return x > 0 && (x & (x - 1)) == 0; }
+
+HierarchyConfig::HierarchyConfig()
+{
+	static const CacheConfig defaults[MAXLEVELS] = {
+		{ 8192, 4, 8, EV_LRU },			// L1
+		{ 16384, 8, 16, EV_LRU },		// L2
+		{ 65536, 16, 48, EV_LRU }		// L3
+	};
+	for (int i = 0; i < MAXLEVELS; i++)
 	{
-		line = memory->READ(a & ADDRESSMASK16);
-		returnValue = (__int16)((__int16)(line.value[offset] << 8) | (__int16)line.value[offset + 1]);
-		totalCost += RAMACCESSCOST;
+		level[i] = defaults[i];
+		level[i].prefetch = PF_NONE;
+		level[i].degree = level[i].distance = 1;
+		level[i].writeThrough = false;
+		level[i].writeAllocate = true;
+		level[i].inclusion = IN_NINE;
+		level[i].victims = 0;
+		level[i].admission = false;
 	}
-	WRITE16(a, returnValue);
-	misses++;
-	return returnValue;
+	levels = MAXLEVELS;
+	lineSize = 64;
+	dataSize = 8;
+	ramCost = 110;
+	combine = 0;
+	cores = 1;
+	coherence = CO_MESI;
+	snoopCost = 40;
+	frequency = 3.0f;
+	specialize = 1;
+	classify = 0;
 }
 
-// write 16-bit data type to cache
-void Cache::WRITE16(address a, __int16 value)
-{
-	int n = (a & setMask) >> 6;
-	int offset = (a & OFFSETMASK16) * 2;
-	for (int i = 0; i < nway; i++)
-		slot[n][i].age++; //LRU
-	
-	for (int i = 0; i < nway; i++)
-	{
-		if (slot[n][i].valid){
-			if ((slot[n][i].tag & ADDRESSMASK16) == (a & ADDRESSMASK16))
-			{
-				//write two bytes
-				slot[n][i].value[offset] = value >> 8;
-				slot[n][i].value[offset + 1] = (value & 0xFF);
-				slot[n][i].dirty = true;
-				totalCost += cost; hits++;
-				slot[n][i].age = 0; //LRU
-				slot[n][i].n_uses++; //LFU
-				return;
-			}
-		}
+bool HierarchyConfig::Load( const char* fileName )
+{
+	FILE* f = fopen( fileName, "r" );
+	if (!f) return false;
+	char line[256], key[128], value[128];
+	bool ok = true;
+	while (fgets( line, sizeof( line ), f ))
+	{
+		for (char* c = line; *c; c++) if (*c == '=') *c = ' ';
+		if (sscanf( line, "%127s %127s", key, value ) != 2 || key[0] == '#') continue;
+		ok &= Set( key, value );
 	}
+	fclose( f );
+	return ok;
+}
 
-	// request a full line from memory/cache
-	CacheLine line;
-	if (nextCache)
-		line = nextCache->READLINE(a & ADDRESSMASK16, ADDRESSMASK16);
-	else
-		line = memory->READ(a & ADDRESSMASK16);
-
-	//if invalid, write entire line
-	for (int i = 0; i < nway; i++)
-	{
-		if (!slot[n][i].valid){
-			slot[n][i].tag = a;
-
-			for (int t = 0; t < SLOTSIZE; t++)
-				slot[n][i].value[t] = line.value[t];
-			//write two bytes
-			slot[n][i].value[offset] = value >> 8;
-			slot[n][i].value[offset + 1] = (value & 0xFF);
-			slot[n][i].valid = true;
-			slot[n][i].dirty = true;
-			totalCost += cost; hits++;
-			slot[n][i].age = 0; //LRU
-			slot[n][i].n_uses++; //LFU
-			return;
+bool HierarchyConfig::Parse( int argc, char** argv )
+{
+	bool ok = true;
+	for (int i = 1; i < argc; i++)
+	{
+		char key[128];
+		const char* eq = strchr( argv[i], '=' );
+		if (!eq || eq - argv[i] >= (int)sizeof( key )) continue; // not a setting; may be meant for someone else
+		strncpy( key, argv[i], eq - argv[i] );
+		key[eq - argv[i]] = 0;
+		if (!strcmp( key, "config" ))
+		{
+			if (!Load( eq + 1 )) printf( "could not open cache configuration '%s'\n", eq + 1 ), ok = false;
 		}
+		else ok &= Set( key, eq + 1 );
 	}
+	return ok;
+}
 
-	int z = EVICTION(n);
-
-	if (slot[n][z].dirty)
+bool HierarchyConfig::Set( const char* key, const char* value )
+{
+	int v = atoi( value );
+	if (!strcmp( key, "levels" )) levels = v;
+	else if (!strcmp( key, "linesize" )) lineSize = v;
+	else if (!strcmp( key, "datasize" )) dataSize = v;
+	else if (!strcmp( key, "ramcost" )) ramCost = v;
+	else if (!strcmp( key, "combine" )) combine = v;
+	else if (!strcmp( key, "cores" )) cores = v;
+	else if (!strcmp( key, "snoopcost" )) snoopCost = v;
+	else if (!strcmp( key, "coherence" ))
+	{
+		int p = 0;
+		while (p <= CO_MOESI && strcmp( value, coherenceName[p] )) p++;
+		if (p > CO_MOESI) { printf( "unknown coherence protocol '%s'\n", value ); return false; }
+		coherence = (CoherenceProtocol)p;
+	}
+	else if (!strcmp( key, "frequency" )) frequency = (float)atof( value );
+	else if (!strcmp( key, "specialize" )) specialize = v;
+	else if (!strcmp( key, "classify" )) classify = v;
+	else if (key[0] == 'l' && key[1] >= '1' && key[1] < '1' + MAXLEVELS && key[2] == '.')
 	{
-		// write the line back to memory or next cache if dirty (no write16 needed, whole line is written)
-		if (nextCache)
+		CacheConfig& c = level[key[1] - '1'];
+		const char* field = key + 3;
+		if (!strcmp( field, "size" )) c.size = v;
+		else if (!strcmp( field, "ways" )) c.nway = v;
+		else if (!strcmp( field, "cost" )) c.cost = v;
+		else if (!strcmp( field, "policy" ))
+		{
+			int p = 0;
+			while (p <= EV_LFUDA && strcmp( value, policyName[p] )) p++;
+			if (p > EV_LFUDA) { printf( "unknown eviction policy '%s'\n", value ); return false; }
+			c.policy = (EvictionPolicy)p;
+		}
+		else if (!strcmp( field, "prefetch" ))
+		{
+			int p = 0;
+			while (p <= PF_STREAM && strcmp( value, prefetchName[p] )) p++;
+			if (p > PF_STREAM) { printf( "unknown prefetcher '%s'\n", value ); return false; }
+			c.prefetch = (PrefetchPolicy)p;
+		}
+		else if (!strcmp( field, "write" ))
 		{
-			nextCache->WRITELINE(slot[n][z].tag & ADDRESSMASK16, slot[n][z], ADDRESSMASK16);
+			if (strcmp( value, "back" ) && strcmp( value, "through" )) { printf( "unknown write policy '%s'\n", value ); return false; }
+			c.writeThrough = !strcmp( value, "through" );
 		}
-		else
+		else if (!strcmp( field, "allocate" )) c.writeAllocate = v != 0;
+		else if (!strcmp( field, "inclusion" ))
 		{
-			memory->WRITE(slot[n][z].tag & ADDRESSMASK16, slot[n][z]);
-			totalCost += RAMACCESSCOST;
+			int p = 0;
+			while (p <= IN_EXCLUSIVE && strcmp( value, inclusionName[p] )) p++;
+			if (p > IN_EXCLUSIVE) { printf( "unknown inclusion policy '%s'\n", value ); return false; }
+			c.inclusion = (InclusionPolicy)p;
 		}
+		else if (!strcmp( field, "victims" )) c.victims = v;
+		else if (!strcmp( field, "admission" )) c.admission = v != 0;
+		else if (!strcmp( field, "degree" )) c.degree = v;
+		else if (!strcmp( field, "distance" )) c.distance = v;
+		else { printf( "unknown cache setting '%s'\n", key ); return false; }
 	}
+	else { printf( "unknown cache setting '%s'\n", key ); return false; }
+	return true;
+}
 
-	//copy entire cacheline
-	for (int t = 0; t < SLOTSIZE; t++)
-		slot[n][z].value[t] = line.value[t];
-	//write two bytes
-	slot[n][z].value[offset] = value >> 8;
-	slot[n][z].value[offset + 1] = (value & 0xFF);
-	slot[n][z].tag = a;
-	slot[n][z].valid = true;
-	slot[n][z].dirty = true;
-	misses++;
-	slot[n][z].age = 0; //LRU
-	slot[n][z].n_uses++; //LFU
-	return;
+bool HierarchyConfig::Validate()
+{
+	bool ok = true;
+	if (levels < 1 || levels > MAXLEVELS) printf( "levels must be 1..%i\n", MAXLEVELS ), ok = false;
+	if (frequency <= 0) printf( "frequency must be positive\n" ), ok = false;
+	if (combine < 0 || combine > MAXCOMBINE) printf( "combine must be 0..%i\n", MAXCOMBINE ), ok = false;
+	if (cores < 1 || cores > MAXCORES) printf( "cores must be 1..%i\n", MAXCORES ), ok = false;
+	if (snoopCost < 0) printf( "snoopcost must not be negative\n" ), ok = false;
+	// the directory sits at the shared level, and hands lines to the private levels above it
+	if (cores > 1 && levels < 2) printf( "several cores need a private level and a shared one\n" ), ok = false;
+	if (cores > 1 && level[levels - 1].inclusion == IN_EXCLUSIVE) printf( "L%i: a level shared by several cores cannot be exclusive\n", levels ), ok = false;
+	if (dataSize != 8 && dataSize != 16 && dataSize != 32) printf( "datasize must be 8, 16 or 32\n" ), ok = false;
+	if (!IsPowerOfTwo( lineSize ) || lineSize > SLOTSIZE || lineSize < 4)
+		printf( "linesize must be a power of two, 4..%i\n", SLOTSIZE ), ok = false;
+	for (int i = 0; i < levels && ok; i++)
+	{
+		CacheConfig& c = level[i];
+		if (!IsPowerOfTwo( c.size ) || !IsPowerOfTwo( c.nway ) || c.size < c.nway * lineSize)
+			printf( "L%i: size and ways must be powers of two, with at least one set\n", i + 1 ), ok = false;
+		if (c.nway > MAXWAYS) printf( "L%i: at most %i ways\n", i + 1, MAXWAYS ), ok = false;
+		if (c.degree < 1 || c.degree > MAXPREFETCHDEGREE || c.distance < 1 || c.distance > MAXPREFETCHDISTANCE)
+			printf( "L%i: prefetch degree must be 1..%i, distance 1..%i\n", i + 1, MAXPREFETCHDEGREE, MAXPREFETCHDISTANCE ), ok = false;
+		if (c.victims < 0 || c.victims > MAXVICTIMS) printf( "L%i: at most %i victim cache entries\n", i + 1, MAXVICTIMS ), ok = false;
+		// a line not admitted here may still be cached above
+		if (c.admission && c.inclusion == IN_INCLUSIVE) printf( "L%i: an inclusive level must admit every line\n", i + 1 ), ok = false;
+		if (i == 0 && c.inclusion != IN_NINE) printf( "L1: there is no level above to include or exclude\n" ), ok = false;
+		if (c.inclusion == IN_EXCLUSIVE && c.prefetch != PF_NONE) printf( "L%i: exclusive levels do not prefetch\n", i + 1 ), ok = false;
+		// written-through bytes would fill the exclusive level with lines the level above still holds
+		if (c.inclusion == IN_EXCLUSIVE && i > 0 && level[i - 1].writeThrough) printf( "L%i: the level above an exclusive level must be write-back\n", i ), ok = false;
+	}
+	return ok;
 }
 
-//read 32-bit data type from cache
-__int32 Cache::READ32(address a){
-	int n = (a & setMask) >> 6; //bitshift offset bits (always 64 with slotsize 64)
-	int offset = (a & OFFSETMASK32) * 4;
-	for (int i = 0; i < nway; i++)
+void HierarchyConfig::Print()
+{
+	printf( "%i level(s), %i-byte lines, %i-bit data, RAM cost %i, %.2f GHz", levels, lineSize, dataSize, ramCost, frequency );
+	if (combine) printf( ", %i-entry write-combining buffer", combine );
+	if (cores > 1) printf( ", %i cores (%s, snoop cost %i)", cores, coherenceName[coherence], snoopCost );
+	if (classify) printf( ", 3C miss classification" );
+	printf( "\n" );
+	for (int i = 0; i < levels; i++)
 	{
-		slot[n][i].age++; //LRU
-		if ((slot[n][i].tag & ADDRESSMASK32) == (a & ADDRESSMASK32))
-		{
-			totalCost += cost; hits++;
-			slot[n][i].age = 0; //LRU
-			slot[n][i].n_uses++; //LFU
-			return (__int32)(slot[n][i].value[offset] << 24) |
-							(slot[n][i].value[offset + 1] << 16) |
-							(slot[n][i].value[offset + 2] << 8) |
-							slot[n][i].value[offset + 3];
-		}
+		printf( "L%i: %iKB, %i-way, %i sets, cost %i, %s", i + 1, level[i].size / 1024, level[i].nway,
+			level[i].size / lineSize / level[i].nway, level[i].cost, policyName[level[i].policy] );
+		if (level[i].writeThrough) printf( ", write-through" );
+		if (!level[i].writeAllocate) printf( ", no write-allocate" );
+		if (level[i].inclusion != IN_NINE) printf( ", %s", inclusionName[level[i].inclusion] );
+		if (level[i].victims) printf( ", %i-entry victim cache", level[i].victims );
+		if (level[i].admission) printf( ", TinyLFU admission" );
+		if (level[i].prefetch != PF_NONE) printf( ", %s prefetch (degree %i, distance %i)", prefetchName[level[i].prefetch], level[i].degree, level[i].distance );
+		printf( "\n" );
 	}
+}
 
-	// Read from next cache if exists, otherwise from memory
-	CacheLine line;
-	__int32 returnValue;
-	if (nextCache)
+// ------------------------------------------------------------------
+// HIERARCHY
+// ------------------------------------------------------------------
+
+Hierarchy::Hierarchy( const HierarchyConfig& _Config ) : config( _Config )
+{
+	clock.frequency = config.frequency;
+	memory = new Memory( RAMSIZE, config.lineSize, config.ramCost, &clock, config.combine );
+	// build the hierarchy from the last level up, so each level can chain to the next;
+	// the other cores chain their private levels to the last level of core 0
+	int last = config.levels - 1;
+	for (int c = 0; c < config.cores; c++) for (int i = last; i >= 0; i--)
+		stack[c][i] = c > 0 && i == last ? stack[0][last] :
+			CreateCache( memory, config.level[i], config.lineSize, i < last ? stack[c][i + 1] : NULL, config.specialize != 0 );
+	cache = stack[0];
+	if (config.classify) for (int c = 0; c < config.cores; c++) for (int i = 0; i < config.levels; i++) if (c == 0 || i < last)
+		stack[c][i]->classifier = new MissClassifier( stack[c][i]->nsets * stack[c][i]->nway, config.lineSize, RAMSIZE );
+	coherence = config.cores > 1 ? new Coherence( this ) : 0;
+	oracle = 0;
+}
+
+Hierarchy::~Hierarchy()
+{
+	for (int c = 0; c < config.cores; c++) for (int i = 0; i < config.levels; i++)
+		if (c == 0 || i < config.levels - 1) delete stack[c][i];
+	delete coherence;
+	delete oracle;
+	delete memory;
+}
+
+Cache* Hierarchy::Begin( address a, bool write, int site, int core )
+{
+	Cache* l1 = stack[core][0];
+	l1->site = site;
+	if (coherence && write) coherence->Write( core, a & l1->addressMask );
+	return l1;
+}
+
+void Hierarchy::Access( address a, int size, bool write, int site, int core )
+{
+	Cache* l1 = Begin( a, write, site, core );
+	switch (size)
 	{
-		returnValue = nextCache->READ32(a);
+	case 2: if (write) l1->WRITE16( a, 0 ); else l1->READ16( a ); break;
+	case 4: if (write) l1->WRITE32( a, 0 ); else l1->READ32( a ); break;
+	default: if (write) l1->WRITE( a, 0 ); else l1->READ( a ); break;
 	}
-	else //read from memory
+}
+
+void Hierarchy::Replay( const TraceRecord* records, int count )
+{
+	// addresses wrap at the simulated RAM size, in case the trace came from a larger workload;
+	// a trace recorded with more cores folds onto the ones configured
+	for (int i = 0; i < count; i++)
 	{
-		line = memory->READ(a & ADDRESSMASK32);
-		returnValue = (__int32)(line.value[offset] << 24) |
-								(line.value[offset + 1] << 16) |
-								(line.value[offset + 2] << 8) |
-								line.value[offset + 3];
-		totalCost += RAMACCESSCOST;
+		address a = records[i].a & (RAMSIZE - 1);
+		if (oracle) oracle->Access( a );
+		Access( a, records[i].size, records[i].write != 0, records[i].site, records[i].core % config.cores );
 	}
+}
 
-	WRITE32(a, returnValue);
-	misses++;
-	return returnValue;
+void Hierarchy::SetNextUse( const NextUse* uses )
+{
+	delete oracle;
+	oracle = new BeladyOracle( uses );
+	for (int c = 0; c < config.cores; c++) for (int i = 0; i < config.levels; i++)
+		if (config.level[i].policy == EV_OPT) stack[c][i]->oracle = oracle;
 }
 
-// write 32-bit data type to cache
-void Cache::WRITE32(address a, __int32 value)
-{
-	int n = (a & setMask) >> 6;
-	int offset = (a & OFFSETMASK32) * 4;
-
-	for (int i = 0; i < nway; i++)
-		slot[n][i].age++; //LRU
-
-	for (int i = 0; i < nway; i++)
-	{
-		if (slot[n][i].valid){
-			if ((slot[n][i].tag & ADDRESSMASK32) == (a & ADDRESSMASK32))
-			{
-				//write four bytes
-				slot[n][i].value[offset]     =  value >> 24;
-				slot[n][i].value[offset+ 1] = (value >> 16) & 0xFF;
-				slot[n][i].value[offset + 2] = (value >> 8) & 0xFF;
-				slot[n][i].value[offset + 3] =  value & 0xFF;
-				slot[n][i].dirty = true;
-				totalCost += cost; hits++;
-				slot[n][i].age = 0; //LRU
-				slot[n][i].n_uses++; //LFU
-				return;
-			}
-		}
+void Hierarchy::UpdateStats()
+{
+	for (int c = 0; c < config.cores; c++) for (int i = 0; i < config.levels; i++) if (c == 0 || i < config.levels - 1)
+	{
+		stack[c][i]->cum_hits += stack[c][i]->hits;
+		stack[c][i]->cum_misses += stack[c][i]->misses;
+		MissClassifier* m = stack[c][i]->classifier;
+		if (m) m->cum_compulsory += m->compulsory, m->cum_capacity += m->capacity, m->cum_conflict += m->conflict;
 	}
+}
 
-	// request a full line from memory/cache
-	CacheLine line;
-	if (nextCache)
-		line = nextCache->READLINE(a & ADDRESSMASK32, ADDRESSMASK32);
-	else
-		line = memory->READ(a & ADDRESSMASK32);
-
-	//if invalid, write entire line
-	for (int i = 0; i < nway; i++)
-	{
-		if (!slot[n][i].valid){
-			slot[n][i].tag = a;
-
-			for (int t = 0; t < SLOTSIZE; t++)
-				slot[n][i].value[t] = line.value[t];
-			//write four bytes
-			slot[n][i].value[offset] = value >> 24;
-			slot[n][i].value[offset + 1] = (value >> 16) & 0xFF;
-			slot[n][i].value[offset + 2] = (value >> 8) & 0xFF;
-			slot[n][i].value[offset + 3] = value & 0xFF;
-			slot[n][i].valid = true;
-			slot[n][i].dirty = true;
-			totalCost += cost; hits++;
-			slot[n][i].age = 0; //LRU
-			slot[n][i].n_uses++; //LFU
-			return;
-		}
+void Hierarchy::ResetTickStats()
+{
+	for (int c = 0; c < config.cores; c++) for (int i = 0; i < config.levels; i++)
+	{
+		stack[c][i]->hits = stack[c][i]->misses = 0;
+		MissClassifier* m = stack[c][i]->classifier;
+		if (m) m->compulsory = m->capacity = m->conflict = 0;
 	}
+}
 
-	int z = EVICTION(n);
+void Hierarchy::Totals( int level, int& hits, int& misses ) const
+{
+	hits = misses = 0;
+	for (int c = 0; c < (level < config.levels - 1 ? config.cores : 1); c++)
+		hits += stack[c][level]->cum_hits, misses += stack[c][level]->cum_misses;
+}
+
+static void ReportLevel( const char* name, const Cache* cache )
+{
+	int accesses = cache->cum_hits + cache->cum_misses;
+	printf( "%s: %i hits, %i misses, hit rate %f%%, cost %llu cycles\n", name, cache->cum_hits, cache->cum_misses,
+		accesses ? cache->cum_hits * 100.0 / accesses : 0.0, cache->totalCost );
+	const VictimCache* v = cache->victimCache;
+	if (v) printf( "    victim cache: %i hits of %i probes (%.2f%% of the misses recovered)\n", v->hits, v->probes, v->probes ? v->hits * 100.0 / v->probes : 0.0 );
+	const TinyLFU* f = cache->admission;
+	if (f) printf( "    admission: %i of %i candidate fills rejected (%.2f%%), sketch halved %i times\n",
+		f->rejected, f->candidates, f->candidates ? f->rejected * 100.0 / f->candidates : 0.0, f->halvings );
+	const MissClassifier* m = cache->classifier;
+	if (m && cache->cum_misses) printf( "    misses: %i compulsory (%.2f%%), %i capacity (%.2f%%), %i conflict (%.2f%%)\n",
+		m->cum_compulsory, m->cum_compulsory * 100.0 / cache->cum_misses, m->cum_capacity, m->cum_capacity * 100.0 / cache->cum_misses,
+		m->cum_conflict, m->cum_conflict * 100.0 / cache->cum_misses );
+	if (cache->insertions) printf( "    %i victims of the level above inserted (not in the counts above)\n", cache->insertions );
+	if (cache->pfHits + cache->pfMisses) printf( "    for prefetches above: %i hits, %i misses, cost %llu cycles (off the clock, not in the counts above)\n",
+		cache->pfHits, cache->pfMisses, cache->pfCost );
+	if (cache->invalidations) printf( "    %i lines invalidated from below or by other cores\n", cache->invalidations );
+	const PrefetchStats& p = cache->prefetchStats;
+	if (cache->prefetcher) printf( "    prefetch: %i issued, %i useful (%i late, waited %llu cycles), %i unused, %i polluting\n",
+		p.issued, p.useful, p.late, p.lateCycles, p.unused, p.polluting );
+}
 
-	if (slot[n][z].dirty)
+void Hierarchy::Report( bool detailed )
+{
+	// the simulated clock is the total cost: every cache level and RAM advance it by their latency
+	if (detailed)
 	{
-		// write the line back to memory or next cache if dirty (no write32 needed, whole line is written)
-		if (nextCache)
+		printf( "total cost: %llu cycles, %.3f ms simulated at %.2f GHz\n", clock.cycles, clock.Seconds() * 1000, clock.frequency );
+		// with several cores: the private levels per core, then the shared one
+		for (int i = 0; i < config.levels; i++) for (int c = 0; c < config.cores; c++)
 		{
-			nextCache->WRITELINE(slot[n][z].tag & ADDRESSMASK32, slot[n][z], ADDRESSMASK32);
+			if (c > 0 && i == config.levels - 1) break;
+			char name[32];
+			if (config.cores > 1 && i < config.levels - 1) sprintf( name, "L%i core %i", i + 1, c ); else sprintf( name, "L%i", i + 1 );
+			ReportLevel( name, stack[c][i] );
 		}
-		else
+		if (coherence) coherence->Print();
+		printf( "RAM: %i line reads, %i line writes (%i partial), cost %llu cycles\n", memory->reads, memory->writes, memory->partialWrites, memory->totalCost );
+		if (memory->pfReads + memory->pfWrites) printf( "    for prefetches: %i line reads, %i line writes, cost %llu cycles (off the clock)\n",
+			memory->pfReads, memory->pfWrites, memory->pfCost );
+		if (memory->combineEntries)
 		{
-			memory->WRITE(slot[n][z].tag & ADDRESSMASK32, slot[n][z]);
-			totalCost += RAMACCESSCOST;
+			int pending = 0;
+			for (int i = 0; i < memory->combineUsed; i++) if (memory->combiner[i].valid) pending++;
+			printf( "write-combining: %i partial writes merged, %i entries pending\n", memory->combined, pending );
 		}
+		return;
 	}
-
-	//copy entire cacheline
-	for (int t = 0; t < SLOTSIZE; t++)
-		slot[n][z].value[t] = line.value[t];
-	//write four bytes
-	slot[n][z].value[offset] = value >> 24;
-	slot[n][z].value[offset + 1] = (value >> 16) & 0xFF;
-	slot[n][z].value[offset + 2] = (value >> 8) & 0xFF;
-	slot[n][z].value[offset + 3] = value & 0xFF;
-	slot[n][z].tag = a;
-	slot[n][z].valid = true;
-	slot[n][z].dirty = true;
-	misses++;
-	slot[n][z].age = 0; //LRU
-	slot[n][z].n_uses++; //LFU
-	return;
+	// report on memory access cost (134M before your improvements :) )
+	printf("total cost: %lluM cycles (%.2f ms)\t", clock.cycles / 1000000, clock.Seconds() * 1000);
+	// report on cache hits and misses
+	for (int i = 0; i < config.levels; i++)
+	{
+		int hits, misses;
+		Totals( i, hits, misses );
+		if (hits != 0) printf("L%i hit: %f%% \t", i + 1, (hits * 100.0 / (hits + misses)));
+	}
+	printf("\n");
+	if (!config.classify) return;
+	// the misses of this tick by cause, over all cores
+	for (int i = 0; i < config.levels; i++)
+	{
+		int n[3] = { 0, 0, 0 };
+		for (int c = 0; c < (i < config.levels - 1 ? config.cores : 1); c++)
+		{
+			const MissClassifier* m = stack[c][i]->classifier;
+			n[0] += m->compulsory, n[1] += m->capacity, n[2] += m->conflict;
+		}
+		printf("L%i misses: %i compulsory, %i capacity, %i conflict\t", i + 1, n[0], n[1], n[2]);
+	}
+	printf("\n");
 }
\ No newline at end of file
@@ -1,102 +1,553 @@
 #pragma once
 
-#define L1CACHESIZE		8192					// total L1$ size, in bytes
-#define L2CACHESIZE		16384					// total L2$ size, in bytes
-#define L3CACHESIZE		65536					// total L3$ size, in bytes
-#define SLOTSIZE		64						// cache slot size, in bytes
-#define NWAY1			4						// >>>>>>>N<<<<<-way cache, L1
-#define NWAY2			8						// >>>>>>>N<<<<<-way cache, L2
-#define NWAY3			16						// >>>>>>>N<<<<<-way cache, L3
-#define ADDRESSMASK		(0x1000000 - SLOTSIZE)	// used for masking out lowest log2(SLOTSIZE) bits
-#define ADDRESSMASK16	(0x1000000 - SLOTSIZE/2) //addressmask for reading/writing 16-bit values
-#define ADDRESSMASK32   (0x1000000 - SLOTSIZE/4) //addressmask for reading/writing 32-bit values
-#define OFFSETMASK		(SLOTSIZE - 1)			// used for masking out bits above log2(SLOTSIZE)
-#define OFFSETMASK16	(SLOTSIZE / 2 - 1)		// offsetmask for reading/writing 16-bit values
-#define OFFSETMASK32	(SLOTSIZE / 4 - 1)		// offsetmask for reading/writing 32-bit values
-#define SETMASK12		(0x7C0)					// used for masking out 5 set bits for L1 and L2 addresses
-#define SETMASK3		(0xFC0)					// used for masking out 6 set bits for L3 addresses
-#define RAMACCESSCOST	110
-#define L1ACCESSCOST	8
-#define L2ACCESSCOST	16						//( + L1ACCESSCOST)
-#define L3ACCESSCOST	48						//( + L2ACCESSCOST + L1ACCESSCOST)
+#define SLOTSIZE		64						// maximum cache line size, in bytes (storage per CacheLine)
+#define MAXLEVELS		3						// maximum number of cache levels in a hierarchy
+#define MAXCORES		8						// maximum number of cores sharing the last level
+#define RAMSIZE			(1024 * 1024 * 2)		// simulated RAM: 2MB (1M is not enough for 32-bit read/writes)
 
 //OPTIONS
+//Cache geometry, latencies, eviction policy, number of levels and data size are runtime
+//settings: see HierarchyConfig below and cache.cfg (or pass key=value on the command line).
 
-//Eviction policy (PICK ONE):
-//Least Recently Used eviction policy.
-	#define EV_LRU	
-//random replacement eviction policy (NOTE: this affects the displayed pattern because of rand() being called!)
-	//#define EV_RANDOM
-//Least Frequently Used eviction policy
-	//#define EV_LFU	
-//Most Recently Used eviction policy
-	//#define EV_MRU		
-//always overwrite first slot
-	//#define EV_CONST
+//Eviction policies (selectable per level):
+enum EvictionPolicy
+{
+	EV_LRU,		//Least Recently Used eviction policy.
+	EV_MRU,		//Most Recently Used eviction policy
+	EV_LFU,		//Least Frequently Used eviction policy
+	EV_RANDOM,	//random replacement eviction policy (a private generator: the workload's rand() sequence is not disturbed)
+	EV_CONST,	//always overwrite first slot
+	EV_PLRU,	//tree pseudo-LRU
+	EV_SRRIP,	//static re-reference interval prediction (inserts with a long interval)
+	EV_BRRIP,	//bimodal RRIP (inserts with a distant interval, mostly)
+	EV_DRRIP,	//SRRIP or BRRIP, whichever misses less in its leader sets
+	EV_DIP,		//LRU, or LRU with bimodal insertion at the LRU end, by set dueling
+	EV_OPT,		//Belady: evict the line used again furthest in the future (trace replay only, see opt.h)
+	EV_HAWKEYE,	//keep what OPT would have kept, as learned per access site (see policy.h)
+	EV_LFUDA	//LFU with dynamic aging: old counts lose weight
+};
+
+//Hardware prefetchers (selectable per level, see prefetch.h):
+enum PrefetchPolicy
+{
+	PF_NONE,	//demand fetches only
+	PF_NEXTLINE,	//tagged next-line
+	PF_STRIDE,	//stride per access site
+	PF_REGION,	//stride per 4KB region
+	PF_STREAM	//stream buffers
+};
+
+//Inclusion of the levels above (selectable per level, L2 and down):
+enum InclusionPolicy
+{
+	IN_NINE,	//non-inclusive, non-exclusive: fills go to every level, evictions stay local
+	IN_INCLUSIVE,	//evictions back-invalidate the copies in the levels above
+	IN_EXCLUSIVE	//filled only with the victims of the level above; a hit moves the line up
+};
+
+//Coherence protocols between the private caches of several cores (see coherence.h):
+enum CoherenceProtocol
+{
+	CO_MESI,	//a read of a modified line writes it back to the shared level
+	CO_MOESI	//... or leaves it dirty with its owner, who supplies it to the readers
+};
 
 //Real-time data visualization:
 #define VISUALIZE			//turn visualization on or off
 #define DATAHEIGHT	 100	//the height of the plotted data in pixels
 #define DELAY		 1      //Adjust the speed of the plotted data by skipping ticks (min. 1, higher = slower);
 
-//Number of caches used (PICK ONE):
-//#define C_ONE
-//#define C_TWO
-#define C_THREE
+typedef unsigned int address;	// byte address (Game scales element indices by the data size)
+
+// geometry, latency and eviction policy of a single cache level
+struct CacheConfig
+{
+	int size;				// total size, in bytes
+	int nway;				// N-way set associativity
+	int cost;				// access cost, in cycles
+	EvictionPolicy policy;
+	PrefetchPolicy prefetch;
+	int degree;				// prefetcher: lines queued per trigger
+	int distance;			// prefetcher: lookahead, in lines (stride prefetchers: in strides)
+	bool writeThrough;		// pass every write on to the next level (lines never become dirty)
+	bool writeAllocate;		// fill the line on a write miss (off: write around it)
+	InclusionPolicy inclusion;
+	int victims;			// entries in the victim cache of this level (0: none)
+	bool admission;			// TinyLFU admission filter: a miss replaces a line only if it was used more often recently
+};
 
-//Data size: use 8-bit, 16-bit or 32-bit data types (PICK ONE):
-#define B8 //(default)
-//#define B16
-//#define B32
+// description of a complete cache hierarchy, loaded at startup
+// defaults are the original compile-time settings (8KB/4-way, 16KB/8-way, 64KB/16-way, LRU)
+class HierarchyConfig
+{
+public:
+	HierarchyConfig();
+	// methods
+	bool Load( const char* fileName );			// read "key = value" lines; false if the file can't be opened
+	bool Parse( int argc, char** argv );		// apply "key=value" arguments; "config=file" loads a file
+	bool Set( const char* key, const char* value );
+	bool Validate();							// check that all masks can be derived from the settings
+	void Print();
+	// data
+	CacheConfig level[MAXLEVELS];
+	int levels;								// number of cache levels in use (1..MAXLEVELS)
+	int lineSize;							// cache line size for all levels, in bytes (power of two, max SLOTSIZE)
+	int dataSize;							// workload data type: 8, 16 or 32 bits
+	int ramCost;							// RAM access cost, in cycles
+	int combine;							// entries in the write-combining buffer in front of RAM (0: none)
+	int cores;								// cores with their own private levels; the last level is shared (1: no sharing)
+	CoherenceProtocol coherence;
+	int snoopCost;							// cycles of a coherence transaction that involves other cores
+	float frequency;						// simulated clock frequency, in GHz (for reporting simulated time)
+	int specialize;							// 1: use compile-time specialized caches for known configurations
+	int classify;							// 1: split the misses of every level into compulsory, capacity and conflict
+};
 
-typedef unsigned int address;
+// simulated time: RAM and every cache level advance the shared cycle counter by their latency
+struct SimClock
+{
+	SimClock() : cycles( 0 ), frequency( 3.0f ), background( false ) {}
+	double Seconds() const { return cycles / (frequency * 1e9); }
+	unsigned long long cycles;
+	float frequency;						// in GHz
+	bool background;						// a prefetch fill is running: its time is rolled back after it (see Cache::Prefetched),
+											// so the levels and RAM count its work apart from the demand traffic
+};
 
+// unit of transfer between RAM and the last cache level
 struct CacheLine
 {
-	byte age = 0; //LRU, MRU eviction policies
-	byte n_uses = 0; //LFU eviction policy
-	uint tag;
 	byte value[SLOTSIZE];
-	bool dirty = false; //valid and dirty bits not included in tag for convenience of implementation
-	bool valid = false;
 };
 
+#define MAXWAYS			32						// a set's valid/dirty state is kept in 32-bit masks
+#define INVALIDTAG		0xFFFFFFFF				// tag of an empty slot (line addresses are never odd)
+
+#ifdef __AVX2__
+#include "immintrin.h"
+#endif
+
+// bitmask of the entries in tags[0..count) that equal t
+// (tags must be 16-byte aligned, count a multiple of 4; constant counts unroll completely)
+inline uint MatchTags( const uint* tags, int count, uint t )
+{
+	uint mask = 0;
+	int i = 0;
+#ifdef __AVX2__
+	const __m256i t8 = _mm256_set1_epi32( t );
+	for (; i + 8 <= count; i += 8)
+		mask |= (uint)_mm256_movemask_ps( _mm256_castsi256_ps( _mm256_cmpeq_epi32( _mm256_loadu_si256( (const __m256i*)(tags + i) ), t8 ) ) ) << i;
+#endif
+	const __m128i t4 = _mm_set1_epi32( t );
+	for (; i < count; i += 4)
+		mask |= (uint)_mm_movemask_ps( _mm_castsi128_ps( _mm_cmpeq_epi32( _mm_load_si128( (const __m128i*)(tags + i) ), t4 ) ) ) << i;
+	return mask;
+}
+
+// index of the lowest set bit (x != 0)
+inline int LowestBit( uint x )
+{
+#ifdef _MSC_VER
+	unsigned long i;
+	_BitScanForward( &i, x );
+	return (int)i;
+#else
+	return __builtin_ctz( x );
+#endif
+}
+
+#define MAXCOMBINE		64						// write-combining buffer entries, at most
+
 class Memory
 {
 public:
 	// ctor/dtor
-	Memory( uint size );
+	Memory( uint size, int lineSize, int cost, SimClock* clock, int combine = 0 );
 	~Memory();
 	// methods
 	CacheLine READ( address a );
 	void WRITE( address a, CacheLine& line );
+	void WRITEBYTES( address a, const byte* bytes, int size );	// part of a line, from a level that wrote through or around
 	// data members
 	CacheLine* data;
-	bool artificialDelay;
+	SimClock* clock;
+	uint size;
+	int lineSize, lineShift, cost, reads, writes;
+	int partialWrites;						// line writes that carried only part of a line
+	unsigned long long totalCost;
+	int pfReads, pfWrites;					// transfers for prefetch fills, not in reads, writes and totalCost
+	unsigned long long pfCost;
+	// write-combining buffer: partial writes collect per line and go to RAM as
+	// one write when their entry is evicted (oldest first), or when it fills up
+	struct Combiner
+	{
+		address tag;
+		unsigned long long valid;			// bytes written so far, one bit each
+		byte value[SLOTSIZE];
+	};
+	Combiner* combiner;
+	int combineEntries, combineUsed, combineOldest;
+	int combined;							// partial writes merged into a pending entry
+private:
+	void Charge( int& count, int& pfCount );
+	Combiner* FindCombiner( address tag );
+	void Drain( Combiner& c );
+};
+
+// prefetch accounting of one cache level
+struct PrefetchStats
+{
+	int issued;								// lines filled by the prefetcher
+	int useful;								// prefetched lines used by a demand access
+	int late;								// ... before their prefetch had completed
+	int unused;								// prefetched lines evicted without being used
+	int polluting;							// demand misses on lines that a prefetch fill evicted
+	unsigned long long lateCycles;			// cycles demand accesses waited for late prefetches
+};
+
+class Prefetcher;
+class Coherence;
+class BeladyOracle;
+
+// ------------------------------------------------------------------
+// VictimCache: a few fully associative lines that catch the lines a
+// level evicts (Jouppi, 1990). The level probes it on a miss before
+// going to the next level; a hit swaps the line back in. LRU among
+// its entries. Lines taken out are copied to a spare line first, so
+// the caller can make room before it uses them.
+// ------------------------------------------------------------------
+#define MAXVICTIMS		32
+#define VICTIMCOST		2						// cycles to probe a victim cache
+
+class VictimCache
+{
+public:
+	VictimCache( int entries, int lineSize );
+	~VictimCache();
+	const byte* Take( address tag, bool& dirty );	// remove a line: its data, in the spare line, or NULL if it is not here
+	// add a line; when that pushes out the oldest one, returns its data (in the spare line)
+	const byte* Insert( address tag, const byte* line, bool dirty, address& outTag, bool& outDirty );
+	bool Invalidate( address tag, byte* line, bool& dirty );	// remove a line, copying its data to line if it is dirty
+	bool Peek( address tag, byte* line );	// copy a line to line if it is here and dirty
+	void Clean( address tag, const byte* line );	// replace a line's data, if it is here, and mark it clean
+	bool Contains( address tag ) { return Find( tag ) >= 0; }
+	// data
+	int entries, lineSize;
+	int probes, hits;
+private:
+	int Find( address tag );
+	address* tags;							// INVALIDTAG: free
+	bool* dirty;
+	uint* age;
+	byte* data;
+	byte spare[SLOTSIZE];
+	uint time;
+};
+
+// ------------------------------------------------------------------
+// TinyLFU (Einziger et al., 2017): admission filter for a level. A
+// count-min sketch estimates how often every line was accessed
+// recently; a miss that would evict a line only fills the cache if
+// the new line's estimate is higher than the victim's, and otherwise
+// bypasses this level. Every SKETCHSAMPLE x lines accesses all
+// counters are halved, so the estimates follow the recent past.
+// Lines accessed once (a stream) rarely beat a reused victim.
+// ------------------------------------------------------------------
+#define SKETCHDEPTH		4						// rows (hash functions) of the sketch
+#define SKETCHMAX		15						// 4-bit counters
+#define SKETCHSAMPLE	10						// accesses per line of capacity between two halvings
+
+class TinyLFU
+{
+public:
+	TinyLFU( int lines );
+	~TinyLFU() { delete[] counters; }
+	void Record( address tag );				// an access of the level
+	bool Admit( address tag, address victim );	// a miss that would replace victim
+	int Estimate( address tag );
+	// data
+	int candidates, rejected, halvings;
+private:
+	uint Slot( address tag, int row ) const;
+	byte* counters;							// SKETCHDEPTH rows of width counters
+	uint width;								// a power of two
+	int additions, sample;
+};
+
+// ------------------------------------------------------------------
+// 3C miss classification (Hill, 1989), per level. A miss is compulsory
+// on the first access to its line ever; a capacity miss if a fully
+// associative LRU cache of the same size would miss as well; and a
+// conflict miss (too few ways) otherwise. The shadow LRU cache sees
+// the same accesses as the level, but no invalidations: misses on
+// lines another core or an inclusive level below took away count as
+// conflicts.
+// ------------------------------------------------------------------
+class MissClassifier
+{
+public:
+	MissClassifier( int lines, int lineSize, int memorySize );
+	~MissClassifier();
+	void Access( address tag, bool hit );
+	// data
+	int compulsory, capacity, conflict;		// this tick
+	int cum_compulsory, cum_capacity, cum_conflict;
+private:
+	bool Shadow( address tag );				// access the shadow cache; true on a hit
+	void Unlink( int i );
+	void Link( int i );						// at the MRU end
+	uint* touched;							// bitmap of the lines accessed at least once
+	int lineSize;
+	// shadow cache: a doubly linked list from MRU (head) to LRU (tail), and an index on it
+	std::unordered_map<address, int> where;
+	address* tags;
+	int* prev, *next;
+	int head, tail, used, lines;
 };
 
+// ------------------------------------------------------------------
+// Cache: the common interface of every cache level. Levels chain
+// through Cache* (nextCache), whatever their implementation; the
+// byte/16/32-bit accessors are built on the single line-level ACCESS.
+// ------------------------------------------------------------------
 class Cache
 {
 public:
 	// ctor/dtor
-	Cache( Memory* mem, int size, int nway, int setMask, int cost, Cache* c = NULL);
-	~Cache();
+	Cache( Memory* mem, const CacheConfig& config, int lineSize, Cache* c = NULL );
+	virtual ~Cache();
+	// line access: returns the line holding address a, after filling it on a miss.
+	// write marks the line dirty; fullLine means the caller overwrites the whole
+	// line, so a miss does not need to fetch it first.
+	virtual byte* ACCESS( address a, bool write, bool fullLine = false ) = 0;
 	// methods
 	byte READ( address a );
-	CacheLine READLINE(address a, int mask);
 	void WRITE( address a, byte );
-	void WRITELINE(address a, CacheLine& line, int mask);
-	int EVICTION(int n);
+	void READLINE( address a, byte* line );
+	void WRITELINE( address a, const byte* line );
+	void WRITEBYTES( address a, const byte* bytes, int size );	// part of a line; from the level above
+	bool TAKE( address a, byte* line );			// exclusive levels: read a line for the level above, and drop it; true if it was dirty
+	void INSERT( address a, const byte* line, bool dirty );	// exclusive levels: a victim of the level above
+	bool INVALIDATE( address a, byte* line );	// drop the line, if present; true if it was dirty (its data is then copied to line)
+	bool PEEK( address a, byte* line );			// coherence: copy the line to line if it is here and dirty
+	void CLEAN( address a, const byte* line );	// coherence: replace the line's data, if it is here, and mark it clean
 	// READ/WRITE functions for (aligned) 16 and 32-bit values
 	//read/write 16-bit value
-    __int16 READ16(address a);
+	__int16 READ16(address a);
 	void WRITE16(address a, __int16);
 	//read/write 32-bit value
 	__int32 READ32(address a);
 	void WRITE32(address a, __int32);
+	void Charge() { Charge( cost ); }		// advance simulated time by the access latency
+	void Charge( int cycles ) { clock->cycles += cycles; if (clock->background) pfCost += cycles; else totalCost += cycles; }
+	// count a lookup; those of a prefetch fill from above go to the pf counters, victims placed by INSERT to insertions
+	void Count( bool hit )
+	{
+		if (inserting) insertions++;
+		else if (clock->background) { if (hit) pfHits++; else pfMisses++; }
+		else if (hit) hits++; else misses++;
+	}
+	// data
+	Memory* memory;
+	Cache* nextCache;						// the level below (NULL: RAM)
+	std::vector<Cache*> above;				// every level above, nearest first per core (empty for L1)
+	SimClock* clock;
+	int hits, misses, cum_hits, cum_misses;	// demand lookups only
+	int pfHits, pfMisses;					// lookups of prefetch fills from the levels above
+	int insertions;							// exclusive levels: victims of the level above placed here
+	int invalidations;						// lines dropped because an inclusive level below evicted them, or another core wrote them
+	unsigned long long totalCost, pfCost;
+	// geometry, derived from the CacheConfig
+	int nway, nsets, cost, lineSize, setMask, setShift, offsetMask, tagStride;
+	address addressMask;
+	uint wayMask;
+	// storage, structure-of-arrays: per set a block of tagStride tags (INVALIDTAG
+	// when empty; 16-way sets fill exactly one 64-byte line), a dirty mask per set,
+	// and the line data, nway lines per set, in a separate array
+	uint* tags;
+	uint* dirty;
+	byte* data;
+	bool writeThrough, writeAllocate;
+	bool inclusive, exclusive;				// relative to the levels above
+	bool exclusiveBelow;					// the next level is exclusive: clean victims go there too
+	bool inserting;							// INSERT is placing a victim: no lookup, so no latency, counts or classification
+	byte around[SLOTSIZE];					// ACCESS returns this on a write miss that does not allocate
+	// prefetching, see prefetch.h; the arrays are only allocated with a prefetcher
+	int site;								// access site of the current demand access (0: unknown)
+	Prefetcher* prefetcher;
+	uint* prefetched;						// per set: mask of prefetched lines not used yet
+	unsigned long long* ready;				// per line: cycle at which its prefetch completes
+	uint* pollution;						// bitmap of the RAM lines evicted by prefetch fills
+	PrefetchStats prefetchStats;
+	VictimCache* victimCache;				// NULL: none
+	TinyLFU* admission;						// NULL: every miss fills
+	MissClassifier* classifier;				// NULL: misses are not classified
+	// the last private level of a core, with several cores: its misses go through the directory
+	Coherence* coherence;
+	int core;
+	const BeladyOracle* oracle;				// policy = opt, during a replay (without one, the level runs LRU)
+protected:
+	bool FETCH( address a, byte* line );		// read a line from the next level or RAM; true if it comes dirty (exclusive next level)
+	void WRITEBACK( address a, const byte* line, bool dirty = true );	// write a dirty line (or any victim, see exclusiveBelow) to the next level or RAM
+	const byte* RECALL( address a, bool& dirty );	// take a line back from the victim cache; NULL if it is not there
+	void EVICT( int set, int way, bool byPrefetch );	// before a valid line is replaced
+	void FORWARD( address a, const byte* bytes, int size );	// write bytes through (or around) this level
+	// after writing size bytes at a into the line ACCESS returned: pass them on if this level
+	// writes through, or did not allocate the line
+	void Written( address a, byte* line, int size ) { if (writeThrough || line == around) FORWARD( a, line + (a & offsetMask), size ); }
+	bool NextPrefetch( address& a );			// take a line from the prefetcher's queue
+	void Observe( address a, bool fullLine, int set, int way );	// after a demand access; way -1: miss
+	void Evicted( int set, int way, bool byPrefetch );	// prefetch accounting of EVICT
+	void Prefetched( int set, int way, unsigned long long issue );	// after a prefetch fill
+	int Furthest( int set );				// OPT victim: the way whose line is used again last
+};
+
+// compile-time log2, for the masks of specialized caches
+template <int N> struct Log2 { enum { value = 1 + Log2<N / 2>::value }; };
+template <> struct Log2<1> { enum { value = 0 }; };
+template <> struct Log2<0> { enum { value = 0 }; };
+
+// ------------------------------------------------------------------
+// CacheT: N-way set associative cache. With SIZE, NWAY and LINESIZE
+// given, geometry and masks are compile-time constants (the set loop
+// unrolls) and POLICY is called directly; CacheT<0, 0, 0, AnyPolicy>
+// takes everything from the runtime CacheConfig instead.
+// Use CreateCache to get the best fit for a configuration.
+// ------------------------------------------------------------------
+template <int SIZE, int NWAY, int LINESIZE, class POLICY> class CacheT : public Cache
+{
+public:
+	enum
+	{
+		STATIC = SIZE > 0, SETS = STATIC ? SIZE / LINESIZE / NWAY : 1, LINESHIFT = Log2<LINESIZE>::value,
+		STRIDE = NWAY < 4 ? 4 : NWAY
+	};
+	CacheT( Memory* mem, const CacheConfig& config, int lineSize, Cache* c = NULL ) : Cache( mem, config, lineSize, c )
+	{
+		policy.Init( config, nsets, nway );
+	}
+	byte* ACCESS( address a, bool write, bool fullLine = false )
+	{
+		if (prefetcher) IssuePrefetches();
+		const int ways = STATIC ? NWAY : nway, stride = STATIC ? STRIDE : tagStride, line = STATIC ? LINESIZE : lineSize;
+		const int n = STATIC ? (a >> LINESHIFT) & (SETS - 1) : (a & setMask) >> setShift;
+		const address tag = a & (STATIC ? ~(address)(LINESIZE - 1) : addressMask);
+		uint* t = tags + n * stride;
+		byte* set = data + n * ways * line;
+		if (!inserting) Charge();
+		policy.Access( n, tag, fullLine ? -1 : site );
+		if (admission && !inserting) admission->Record( tag );
+		// compare all ways of the set at once
+		uint match = MatchTags( t, stride, tag );
+		if (classifier && !clock->background && !inserting) classifier->Access( tag, match != 0 );
+		if (match)
+		{
+			int i = LowestBit( match );
+			Count( true );
+			policy.Touch( n, i );
+			if (write && !writeThrough) dirty[n] |= 1 << i;
+			if (prefetcher && !inserting) Observe( a, fullLine, n, i );
+			return set + i * line;
+		}
+		Count( false );
+		if (prefetcher && !inserting) Observe( a, fullLine, n, -1 );
+		// the victim cache is probed before the next level
+		bool fetchedDirty = false;
+		const byte* recalled = victimCache ? RECALL( tag, fetchedDirty ) : 0;
+		if (write && !writeAllocate && !recalled) return around; // the caller's Written passes the bytes on
+		// use an empty slot if there is one, otherwise evict
+		uint empty = MatchTags( t, stride, INVALIDTAG ) & wayMask;
+		int i;
+		if (empty) i = LowestBit( empty ); else
+		{
+			i = oracle ? Furthest( n ) : policy.Victim( n );
+			// not admitted: serve the access around this level, like a write miss that does not allocate
+			// (a line taken from an exclusive level below must stay, it may be its only copy)
+			if (admission && !recalled && !exclusiveBelow && !admission->Admit( tag, t[i] ))
+			{
+				if (!write && !fullLine) FETCH( tag, around );
+				return around;
+			}
+			policy.Evict( n, i );
+			EVICT( n, i, false );
+		}
+		if (recalled) memcpy( set + i * line, recalled, line );
+		else if (!fullLine) fetchedDirty = FETCH( tag, set + i * line );
+		t[i] = tag;
+		if ((write && !writeThrough) || fetchedDirty) dirty[n] |= 1 << i; else dirty[n] &= ~(1 << i);
+		policy.Fill( n, i );
+		return set + i * line;
+	}
+	// fill the lines the prefetcher queued since the last access. Prefetches run in
+	// the background: they do not advance the simulated clock, but a prefetched line
+	// is only ready once its fetch latency has passed (see Cache::Observe).
+	void IssuePrefetches()
+	{
+		const int ways = STATIC ? NWAY : nway, stride = STATIC ? STRIDE : tagStride, line = STATIC ? LINESIZE : lineSize;
+		address a;
+		while (NextPrefetch( a ))
+		{
+			const int n = STATIC ? (a >> LINESHIFT) & (SETS - 1) : (a & setMask) >> setShift;
+			const address tag = a & (STATIC ? ~(address)(LINESIZE - 1) : addressMask);
+			uint* t = tags + n * stride;
+			byte* set = data + n * ways * line;
+			if (MatchTags( t, stride, tag ) || (victimCache && victimCache->Contains( tag ))) continue; // already cached
+			unsigned long long issue = clock->cycles;
+			bool background = clock->background;
+			clock->background = true;
+			policy.Access( n, tag, -1 );
+			uint empty = MatchTags( t, stride, INVALIDTAG ) & wayMask;
+			int i;
+			if (empty) i = LowestBit( empty ); else
+			{
+				i = oracle ? Furthest( n ) : policy.Victim( n );
+				policy.Evict( n, i );
+				EVICT( n, i, true );
+			}
+			bool fetchedDirty = FETCH( tag, set + i * line );
+			t[i] = tag;
+			if (fetchedDirty) dirty[n] |= 1 << i; else dirty[n] &= ~(1 << i);
+			policy.Fill( n, i );
+			Prefetched( n, i, issue );
+			clock->background = background;
+		}
+	}
+	// data
+	POLICY policy;
+};
+
+Cache* CreateCache( Memory* mem, const CacheConfig& config, int lineSize, Cache* c = NULL, bool specialize = true );
+
+// ------------------------------------------------------------------
+// Hierarchy: simulated RAM plus the configured cache levels, chained
+// L1 -> Ln -> RAM, with a shared simulated clock. Driven by the game
+// (Set/Get) or by a recorded trace (Replay). With several cores, each
+// core has its own L1..Ln-1 and they all share Ln; a directory keeps
+// their private copies coherent (see coherence.h).
+// ------------------------------------------------------------------
+struct TraceRecord;
+class NextUse;
+class Hierarchy
+{
+public:
+	// ctor/dtor
+	Hierarchy( const HierarchyConfig& config );
+	~Hierarchy();
+	// methods
+	Cache* Begin( address a, bool write, int site = 0, int core = 0 );	// the L1 for an access by core, after the coherence actions it needs
+	void Access( address a, int size, bool write, int site = 0, int core = 0 );	// one 1, 2 or 4-byte access at L1 (written values are not tracked)
+	void Replay( const TraceRecord* records, int count );
+	void UpdateStats();										// add hits and misses to the cumulative counters
+	void ResetTickStats();									// clear the hits and misses of the current tick
+	void Totals( int level, int& hits, int& misses ) const;		// cumulative hits and misses of a level, over all cores
+	void Report( bool detailed = false );
+	void SetNextUse( const NextUse* uses );					// before a replay: the next-use times of its trace, for the levels on OPT
 	// data
-	CacheLine **slot;
+	HierarchyConfig config;
+	SimClock clock;
 	Memory* memory;
-	Cache* nextCache;
-	int hits, misses, totalCost, setMask, nway, cost, cum_hits, cum_misses;
+	Cache* stack[MAXCORES][MAXLEVELS];						// per core: L1 first; the last level is the same for all
+	Cache** cache;											// core 0: cache[0] is L1; only the first config.levels are used
+	Coherence* coherence;									// NULL with one core
+	BeladyOracle* oracle;									// NULL unless SetNextUse was called
 };
\ No newline at end of file
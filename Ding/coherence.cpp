@@ -0,0 +1,113 @@
+#include "template.h"
+
+Coherence::Coherence( Hierarchy* _Hierarchy )
+{
+	hierarchy = _Hierarchy;
+	levels = hierarchy->config.levels - 1;
+	shared = hierarchy->stack[0][levels];
+	moesi = hierarchy->config.coherence == CO_MOESI;
+	memset( &stats, 0, sizeof( stats ) );
+	// the last private level of every core sends its misses here
+	for (int c = 0; c < hierarchy->config.cores; c++)
+	{
+		Cache* p = hierarchy->stack[c][levels - 1];
+		p->coherence = this, p->core = c;
+	}
+}
+
+void Coherence::Write( int core, address a )
+{
+	Entry& e = directory[a];
+	uint self = 1u << core;
+	if (e.owner == core && !e.shared) return; // M or E: the store is silent
+	stats.requests++;
+	uint others = e.sharers & ~self;
+	if (e.owner >= 0 && e.owner != core) others |= 1u << e.owner;
+	if (others)
+	{
+		stats.upgrades++;
+		Snoop();
+		byte line[SLOTSIZE];
+		for (int c = 0; others; c++, others >>= 1) if (others & 1)
+		{
+			stats.invalidations++;
+			if (Invalidate( c, a, line )) shared->WRITELINE( a, line ), stats.writebacks++;
+		}
+	}
+	e.sharers = self, e.owner = core, e.shared = false;
+}
+
+bool Coherence::Read( int core, address a, byte* line )
+{
+	stats.requests++;
+	Entry& e = directory[a];
+	uint self = 1u << core;
+	bool supplied = false;
+	if (e.owner >= 0 && e.owner != core)
+	{
+		stats.downgrades++;
+		Snoop();
+		if (moesi)
+		{
+			// a dirty owner keeps the line (O) and sends it over; a clean one drops to S
+			if (Peek( e.owner, a, line )) supplied = true, e.shared = true, stats.transfers++;
+			else e.owner = -1;
+		}
+		else
+		{
+			if (Peek( e.owner, a, line ))
+			{
+				Clean( e.owner, a, line );
+				shared->WRITELINE( a, line );
+				stats.writebacks++;
+			}
+			e.owner = -1;
+		}
+	}
+	e.sharers |= self;
+	if (e.owner < 0 && e.sharers == self) e.owner = core, e.shared = false; // the only copy: E
+	return supplied;
+}
+
+void Coherence::Snoop()
+{
+	int cost = hierarchy->config.snoopCost;
+	hierarchy->clock.cycles += cost;
+	if (!hierarchy->clock.background) stats.cycles += cost; // a prefetch fill's snoops are rolled back with it
+}
+
+// the private levels of a core, nearest the shared level first, so L1's copy (the newest) comes last
+bool Coherence::Invalidate( int core, address a, byte* line )
+{
+	bool found = false, dirty = false;
+	for (int i = levels - 1; i >= 0; i--)
+	{
+		Cache* p = hierarchy->stack[core][i];
+		int before = p->invalidations;
+		if (p->INVALIDATE( a, line )) dirty = true;
+		if (p->invalidations != before) found = true;
+	}
+	if (found) stats.invalidated++;
+	return dirty;
+}
+
+bool Coherence::Peek( int core, address a, byte* line )
+{
+	bool dirty = false;
+	for (int i = levels - 1; i >= 0; i--) if (hierarchy->stack[core][i]->PEEK( a, line )) dirty = true;
+	return dirty;
+}
+
+// every copy gets the newest data: a level that keeps an older one could otherwise serve it again
+void Coherence::Clean( int core, address a, const byte* line )
+{
+	for (int i = 0; i < levels; i++) hierarchy->stack[core][i]->CLEAN( a, line );
+}
+
+void Coherence::Print()
+{
+	printf( "coherence (%s, %i cores): %i directory requests, %i upgrades, %i downgrades, %i cache-to-cache transfers\n",
+		moesi ? "MOESI" : "MESI", hierarchy->config.cores, stats.requests, stats.upgrades, stats.downgrades, stats.transfers );
+	printf( "    %i invalidations sent (%i found a copy), %i protocol writebacks, snoop cost %llu cycles\n",
+		stats.invalidations, stats.invalidated, stats.writebacks, stats.cycles );
+}
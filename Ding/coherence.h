@@ -0,0 +1,65 @@
+#pragma once
+
+// ------------------------------------------------------------------
+// CACHE COHERENCE
+// With cores > 1 every core has its own L1..Ln-1 and all of them
+// share Ln. A directory next to the shared level tracks, per line,
+// which cores may hold a copy and which one owns it:
+//   M/E  one core owns the line (E until its stores make it dirty,
+//        which takes no directory action)
+//   S    any number of cores hold clean copies
+//   O    (MOESI) one core keeps the line dirty and supplies it to
+//        the readers, which hold it in S
+// A store by a core that does not own the line invalidates every
+// other copy first; dirty data found there goes to the shared level.
+// A miss of a core's private levels that finds another core owning
+// the line downgrades it: under MESI dirty data is written back to
+// the shared level and both copies become S; under MOESI the owner
+// keeps it dirty (O) and hands the line over cache-to-cache.
+// Evictions are silent, so the directory may still list cores that
+// dropped the line; their invalidations are sent and counted, but
+// find nothing. Transactions that involve other cores cost snoopcost
+// cycles on top of the accesses they cause.
+//   cores = 4    coherence = moesi    snoopcost = 40
+// ------------------------------------------------------------------
+
+struct CoherenceStats
+{
+	int requests;							// directory lookups: private-level misses, and stores without ownership
+	int upgrades;							// stores that invalidated other copies
+	int invalidations;						// invalidation messages sent
+	int invalidated;						// ... that found a copy
+	int downgrades;							// misses that found another core owning the line
+	int transfers;							// lines supplied by another core's cache (MOESI)
+	int writebacks;							// dirty lines written to the shared level by the protocol
+	unsigned long long cycles;				// snoop cycles charged
+};
+
+class Hierarchy;
+class Coherence
+{
+public:
+	Coherence( Hierarchy* hierarchy );
+	void Write( int core, address a );		// before a store: make core the only holder of the line
+	bool Read( int core, address a, byte* line );	// a miss of core's private levels; true if another core supplied the line
+	void Print();
+	// data
+	CoherenceStats stats;
+private:
+	struct Entry
+	{
+		// a new entry: no core has the line (I everywhere)
+		uint sharers = 0;					// cores that may hold a copy, one bit each
+		int owner = -1;						// core holding it M, E or O (-1: none)
+		bool shared = false;				// the owner shares it dirty (O)
+	};
+	void Snoop();
+	bool Invalidate( int core, address a, byte* line );	// drop core's copies; true if one was dirty (newest data in line)
+	bool Peek( int core, address a, byte* line );		// newest dirty copy of core, if any
+	void Clean( int core, address a, const byte* line );
+	Hierarchy* hierarchy;
+	Cache* shared;
+	int levels;								// private levels per core
+	bool moesi;
+	std::unordered_map<address, Entry> directory;
+};
@@ -11,27 +11,9 @@ Cache* lastCache;
 // -----------------------------------------------------------
 void Game::Init()
 {
-	// instantiate simulated memory and cache
-	memory = new Memory( 1024 * 1024 * 2); // allocate 2MB (1M is not enough for 32-bit read/writes)
-	//cache initialization (all 3 caches must always be initialized)
-#ifdef C_ONE
-	cache3 = new Cache(memory, L3CACHESIZE, NWAY3, SETMASK3, L3ACCESSCOST);
-	cache2 = new Cache(memory, L2CACHESIZE, NWAY2, SETMASK12, L2ACCESSCOST);
-	cache1 = new Cache(memory, L1CACHESIZE, NWAY1, SETMASK12, L1ACCESSCOST);
-	lastCache = cache1;
-#endif
-#ifdef C_TWO
-	cache3 = new Cache(memory, L3CACHESIZE, NWAY3, SETMASK3, L3ACCESSCOST);
-	cache2 = new Cache(memory, L2CACHESIZE, NWAY2, SETMASK12, L2ACCESSCOST);
-	cache1 = new Cache(memory, L1CACHESIZE, NWAY1, SETMASK12, L1ACCESSCOST, cache2);
-	lastCache = cache2;
-#endif
-#ifdef C_THREE
-	cache3 = new Cache(memory, L3CACHESIZE, NWAY3, SETMASK3, L3ACCESSCOST);
-	cache2 = new Cache(memory, L2CACHESIZE, NWAY2, SETMASK12, L2ACCESSCOST, cache3);
-	cache1 = new Cache(memory, L1CACHESIZE, NWAY1, SETMASK12, L1ACCESSCOST, cache2);
-	lastCache = cache3;
-#endif
+	// instantiate simulated memory and caches
+	hierarchy = new Hierarchy( config );
+	lastCache = hierarchy->cache[config.levels - 1];
 	//instantiate data visualizer on -1 (= don't draw)
 	for (int i = 0; i < DATAHEIGHT; i++)
 		for (int n = 0; n < SCRWIDTH; n++)
@@ -44,38 +26,38 @@ void Game::Init()
 	Set( 512, 512, IRand( 255 ) );
 	// put first subdivision task on stack
 	taskPtr = 0;
+	core = executed = 0;
 	Push( 0, 0, 512, 512, 256 );
 }
 
 // -----------------------------------------------------------
 // Helper functions for reading and writing data
 // -----------------------------------------------------------
-void Game::Set( int x, int y, byte value )
+void Game::Set( int x, int y, byte value, int site )
 {
-	address a = x + y * 513;
-#ifdef B8
-	cache1->WRITE(a, value);
-#endif
-#ifdef B16
-	cache1->WRITE16(a, value);
-#endif
-#ifdef B32
-	cache1->WRITE32(a, value);
-#endif
-	m[a] = value;
+	int i = x + y * 513;
+	address a = i * (config.dataSize / 8); // byte address of the element
+	if (trace) trace->Record( a, config.dataSize / 8, true, site, core );
+	Cache* l1 = hierarchy->Begin( a, true, site, core );
+	switch (config.dataSize)
+	{
+	case 8: l1->WRITE(a, value); break;
+	case 16: l1->WRITE16(a, value); break;
+	case 32: l1->WRITE32(a, value); break;
+	}
+	m[i] = value;
 }
-byte Game::Get( int x, int y )
+byte Game::Get( int x, int y, int site )
 {
-	address a = x + y * 513;
-#ifdef B8
-	return  cache1->READ(a);
-#endif
-#ifdef B16
-	return  cache1->READ16(a);
-#endif
-#ifdef B32
-	return  cache1->READ32(a);
-#endif
+	address a = (x + y * 513) * (config.dataSize / 8);
+	if (trace) trace->Record( a, config.dataSize / 8, false, site, core );
+	Cache* l1 = hierarchy->Begin( a, false, site, core );
+	switch (config.dataSize)
+	{
+	case 16: return (byte)l1->READ16(a);
+	case 32: return (byte)l1->READ32(a);
+	default: return l1->READ(a);
+	}
 }
 
 // -----------------------------------------------------------
@@ -87,12 +69,12 @@ void Game::Subdivide( int x1, int y1, int x2, int y2, int scale )
 	if ((x2 - x1) == 1) return;
 	// calculate diamond vertex positions
 	int cx = (x1 + x2) / 2, cy = (y1 + y2) / 2;
-	// set vertices
-	if (Get( cx, y1 ) == 0) Set( cx, y1, (Get( x1, y1 ) + Get( x2, y1 )) / 2 + IRand( scale ) - scale / 2 );
-	if (Get( cx, y2 ) == 0) Set( cx, y2, (Get( x1, y2 ) + Get( x2, y2 )) / 2 + IRand( scale ) - scale / 2 );
-	if (Get( x1, cy ) == 0) Set( x1, cy, (Get( x1, y1 ) + Get( x1, y2 )) / 2 + IRand( scale ) - scale / 2 );
-	if (Get( x2, cy ) == 0) Set( x2, cy, (Get( x2, y1 ) + Get( x2, y2 )) / 2 + IRand( scale ) - scale / 2 );
-	if (Get( cx, cy ) == 0) Set( cx, cy, (Get( x1, y1 ) + Get( x2, y2 )) / 2 + IRand( scale ) - scale / 2 );
+	// set vertices (last argument: access site id, 4 per vertex: test, two neighbours, store)
+	if (Get( cx, y1, 1 ) == 0) Set( cx, y1, (Get( x1, y1, 2 ) + Get( x2, y1, 3 )) / 2 + IRand( scale ) - scale / 2, 4 );
+	if (Get( cx, y2, 5 ) == 0) Set( cx, y2, (Get( x1, y2, 6 ) + Get( x2, y2, 7 )) / 2 + IRand( scale ) - scale / 2, 8 );
+	if (Get( x1, cy, 9 ) == 0) Set( x1, cy, (Get( x1, y1, 10 ) + Get( x1, y2, 11 )) / 2 + IRand( scale ) - scale / 2, 12 );
+	if (Get( x2, cy, 13 ) == 0) Set( x2, cy, (Get( x2, y1, 14 ) + Get( x2, y2, 15 )) / 2 + IRand( scale ) - scale / 2, 16 );
+	if (Get( cx, cy, 17 ) == 0) Set( cx, cy, (Get( x1, y1, 18 ) + Get( x2, y2, 19 )) / 2 + IRand( scale ) - scale / 2, 20 );
 	// push new tasks
 	Push( x1, y1, cx, cy, scale / 2 );
 	Push( cx, y1, x2, cy, scale / 2 );
@@ -101,21 +83,31 @@ void Game::Subdivide( int x1, int y1, int x2, int y2, int scale )
 }
 
 // -----------------------------------------------------------
-// Main game tick function
+// Execute a batch of subdivision tasks
 // -----------------------------------------------------------
-void Game::Tick( float dt )
+bool Game::Step( int tasks )
 {
-	// execute 128 tasks per frame
-	for( int i = 0; i < 128; i++ )
+	for( int i = 0; i < tasks; i++ )
 	{
-		// execute one subdivision task
+		// execute one subdivision task, on the next core in turn
 		if (taskPtr == 0) break;
+		core = executed++ % config.cores;
 		int x1 = task[--taskPtr].x1, x2 = task[taskPtr].x2;
 		int y1 = task[taskPtr].y1, y2 = task[taskPtr].y2;
 		Subdivide( x1, y1, x2, y2, task[taskPtr].scale );
 	}
-	// artificial RAM access delay and cost counting are disabled here
-	memory->artificialDelay = false, c = cache1->totalCost;
+	return taskPtr > 0;
+}
+
+// -----------------------------------------------------------
+// Main game tick function
+// -----------------------------------------------------------
+void Game::Tick( float dt )
+{
+	Cache** cache = hierarchy->cache;
+	// execute 128 tasks per frame
+	Step( 128 );
+	// plot the height map (reads m[] directly, so no simulated cost)
 	for (int y = 0; y < 513; y++) for (int x = 0; x < 513; x++)
 	{
 		Pixel ding = GREY(m[x + y * 513]);
@@ -125,43 +117,31 @@ void Game::Tick( float dt )
 		}
 		screen->Plot(x + 140, y + 60, GREY(m[x + y * 513]));
 	}
-	memory->artificialDelay = true, cache1->totalCost = c;
 	//real-time data visulization
 	//cumulative hits and misses update
-	cache1->cum_hits += cache1->hits;
-	cache1->cum_misses += cache1->misses;
-	cache2->cum_hits += cache2->hits;
-	cache2->cum_misses += cache2->misses;
-	cache3->cum_hits += cache3->hits;
-	cache3->cum_misses += cache3->misses;
-	// report on memory access cost (134M before your improvements :) )
-	printf("total cost: %iM cycles\t", (cache1->totalCost + cache2->totalCost + cache3->totalCost )/ 1000000);
-	// report on cache hits and misses
-	if (cache1->cum_hits != 0) printf("L1 hit: %f%% \t", (cache1->cum_hits * 100.0 / (cache1->cum_hits + cache1->cum_misses)));
-	if (cache2->cum_hits != 0) printf("L2 hit: %f%% \t", (cache2->cum_hits * 100.0 / (cache2->cum_hits + cache2->cum_misses)));
-	if (cache3->cum_hits != 0) printf("L3 hit: %f%% \n", (cache3->cum_hits * 100.0 / (cache3->cum_hits + cache3->cum_misses)));
-	printf("\n");
+	UpdateStats();
+	Report();
 #ifdef VISUALIZE
-	int total = cache1->hits + cache2->hits + cache3->hits + lastCache->misses;
+	int total = lastCache->misses;
+	for (int i = 0; i < config.levels; i++) total += cache[i]->hits;
 	if (total != 0)
 	{
 		int ram = lastCache->misses * DATAHEIGHT / total;
-		int h_cache1 = cache1->hits * DATAHEIGHT / total;
-		int h_cache2 = cache2->hits * DATAHEIGHT / total;
-		int h_cache3 = cache3->hits * DATAHEIGHT / total;
+		int h_cache[MAXLEVELS];
+		for (int l = 0; l < config.levels; l++) h_cache[l] = cache[l]->hits * DATAHEIGHT / total;
 		//skip some ticks maybe
 		if (drawcounter % DELAY == 0)
 		{
-			//fill new column of data array
+			//fill new column of data array: L1 hits at the bottom, then L2, L3 and RAM on top
 			for (int i = 0; i < DATAHEIGHT; i++)
 			{
-				if (i < h_cache1)
-					data[columncounter][i] = 1;
-				else if (i < h_cache1 + h_cache2)
-					data[columncounter][i] = 2;
-				else if (i < h_cache1 + h_cache2 + h_cache3)
-					data[columncounter][i] = 3;
-				else if (i < ram + h_cache3 + h_cache2 + h_cache1)
+				int top = 0, l = 0;
+				for (; l < config.levels; l++)
+				{
+					top += h_cache[l];
+					if (i < top) { data[columncounter][i] = l + 1; break; }
+				}
+				if (l == config.levels && i < top + ram)
 					data[columncounter][i] = 0;
 			}
 		}
@@ -177,12 +157,7 @@ void Game::Tick( float dt )
 	drawcounter++;
 #endif
 	//reset hits and misses for next tick (because of reasons)
-	cache1->hits = 0;
-	cache1->misses = 0;
-	cache2->hits = 0;
-	cache2->misses = 0;
-	cache3->hits = 0;
-	cache3->misses = 0;
+	hierarchy->ResetTickStats();
 }
 
 // -----------------------------------------------------------
@@ -190,8 +165,5 @@ void Game::Tick( float dt )
 // -----------------------------------------------------------
 void Game::Shutdown()
 {
-	delete memory;
-	delete cache1;
-	delete cache2;
-	delete cache3;
+	delete hierarchy;
 }
\ No newline at end of file
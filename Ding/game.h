@@ -14,12 +14,15 @@ class Surface;
 class Game
 {
 public:
+	Game() : hierarchy( 0 ), trace( 0 ), core( 0 ) {}
 	void SetTarget( Surface* _Surface ) { screen = _Surface; }
+	void SetConfig( const HierarchyConfig& _Config ) { config = _Config; }
+	void SetTrace( TraceWriter* _Trace ) { trace = _Trace; }	// record every Set/Get; NULL to stop
 	void Init();
 	void Shutdown();
 	void HandleInput( float dt ) {}
-	void Set( int x, int y, byte value );
-	byte Get( int x, int y );
+	void Set( int x, int y, byte value, int site = 0 );	// site: id of the calling code location, for traces and prefetchers
+	byte Get( int x, int y, int site = 0 );
 	void Push( int x1, int y1, int x2, int y2, int scale )
 	{
 		task[taskPtr].x1 = x1, task[taskPtr].x2 = x2;
@@ -27,6 +30,9 @@ public:
 		task[taskPtr++].scale = scale;
 	}
 	void Subdivide( int x1, int y1, int x2, int y2, int scale );
+	bool Step( int tasks );				// execute up to 'tasks' subdivision tasks; false when the fractal is done
+	void UpdateStats() { hierarchy->UpdateStats(); }	// add this tick's hits and misses to the cumulative counters
+	void Report( bool detailed = false ) { hierarchy->Report( detailed ); }
 	void Tick( float dt );
 	void MouseUp( int _Button ) { /* implement if you want to detect mouse button presses */ }
 	void MouseDown( int _Button ) { /* implement if you want to detect mouse button presses */ }
@@ -35,12 +41,13 @@ public:
 	void KeyDown( int a_Key ) { /* implement if you want to handle keys */ }
 private:
 	Surface* screen;
-	Memory* memory;
-	Cache* cache1;
-	Cache* cache2;
-	Cache* cache3;
+	HierarchyConfig config;
+	Hierarchy* hierarchy;				// simulated RAM and caches
+	TraceWriter* trace;
 	Task task[512];
-	int taskPtr, c;
+	int taskPtr;
+	// with several cores, tasks run on them in turn: accesses carry the core of their task
+	int core, executed;
 	//real-time visualization
 	int data[SCRWIDTH][DATAHEIGHT];
 };
@@ -0,0 +1,137 @@
+#include "template.h"
+
+// ------------------------------------------------------------------
+// STACK DISTANCE
+// ------------------------------------------------------------------
+
+int StackDistance::Access( uint line )
+{
+	if (now + 1 >= (int)tree.size()) Renumber();
+	int d = -1;
+	std::unordered_map<uint, int>::iterator i = last.find( line );
+	if (i == last.end()) last[line] = now; else
+	{
+		// lines whose most recent access lies between the previous access and now
+		d = Count( now ) - Count( i->second + 1 );
+		Add( i->second, -1 );
+		i->second = now;
+	}
+	Add( now++, 1 );
+	return d;
+}
+
+void StackDistance::Renumber()
+{
+	// out of time stamps: give the live lines times 0..n-1 in their current
+	// order, and make room for at least as many accesses again
+	std::vector<std::pair<int, uint> > order;
+	order.reserve( last.size() );
+	for (std::unordered_map<uint, int>::iterator i = last.begin(); i != last.end(); ++i) order.push_back( std::make_pair( i->second, i->first ) );
+	std::sort( order.begin(), order.end() );
+	int n = (int)order.size(), size = 64;
+	while (size < n * 2 + 2) size *= 2;
+	tree.assign( size, 0 );
+	for (now = 0; now < n; now++) last[order[now].second] = now, Add( now, 1 );
+}
+
+// ------------------------------------------------------------------
+// MISS-RATIO CURVES
+// ------------------------------------------------------------------
+
+MissRatioCurve::MissRatioCurve( int _Sets, int _MaxWays ) : sets( _Sets ), maxWays( _MaxWays ), hist( _MaxWays, 0 )
+{
+	stack = new StackDistance[sets];
+	accesses = cold = beyond = 0;
+}
+
+MissRatioCurve::~MissRatioCurve()
+{
+	delete[] stack;
+}
+
+void MissRatioCurve::Access( uint line )
+{
+	int d = stack[line & (sets - 1)].Access( line );
+	accesses++;
+	if (d < 0) cold++; else if (d >= maxWays) beyond++; else hist[d]++;
+}
+
+unsigned long long MissRatioCurve::Misses( int ways ) const
+{
+	// every access at distance >= ways misses
+	unsigned long long misses = cold + beyond;
+	for (int d = ways; d < maxWays; d++) misses += hist[d];
+	return misses;
+}
+
+void MissRatioCurve::MissCurve( unsigned long long* misses ) const
+{
+	misses[maxWays] = cold + beyond;
+	for (int w = maxWays - 1; w > 0; w--) misses[w] = misses[w + 1] + hist[w];
+}
+
+MissRatioAnalysis::MissRatioAnalysis( int _LineSize ) : lineSize( _LineSize )
+{
+	for (lineShift = 0; (1 << lineShift) < lineSize; lineShift++);
+	// one curve per set count; each tracks the ways that keep it within MRCMAXSIZE
+	int lines = MRCMAXSIZE / lineSize;
+	for (count = 0; (1 << count) <= lines; count++) curve[count] = new MissRatioCurve( 1 << count, lines >> count );
+}
+
+MissRatioAnalysis::~MissRatioAnalysis()
+{
+	for (int i = 0; i < count; i++) delete curve[i];
+}
+
+void MissRatioAnalysis::Replay( const TraceRecord* records, int n )
+{
+	// the set mappings are independent: with job threads, each takes its own pass over the records
+	if (JobManager::GetJobManager()) parallel_for( 0, count, 1, [=]( int i )
+	{
+		for (int j = 0; j < n; j++) curve[i]->Access( records[j].a >> lineShift );
+	} );
+	else for (int i = 0; i < n; i++) Access( records[i].a );
+}
+
+void MissRatioAnalysis::Print()
+{
+	static const int ways[] = { 1, 2, 4, 8, 16, 32 };
+	printf( "LRU miss ratio by capacity and associativity (%i-byte lines, %llu accesses, %llu cold misses):\n",
+		lineSize, curve[0]->accesses, curve[0]->cold );
+	printf( "    size" );
+	for (int w = 0; w < 6; w++) printf( " %6i-way", ways[w] );
+	printf( "       full\n" );
+	for (int size = MRCMINSIZE > lineSize ? MRCMINSIZE : lineSize; size <= MRCMAXSIZE; size *= 2)
+	{
+		int lines = size / lineSize;
+		printf( "%6iKB", size / 1024 );
+		for (int w = 0; w < 6; w++)
+		{
+			// sets = lines / ways; curve[i] has 1 << i sets
+			int i = 0;
+			while ((ways[w] << i) < lines) i++;
+			if ((ways[w] << i) != lines || !curve[0]->accesses) printf( "           " );
+			else printf( " %9.4f%%", curve[i]->Misses( ways[w] ) * 100.0 / curve[i]->accesses );
+		}
+		if (curve[0]->accesses) printf( " %9.4f%%", curve[0]->Misses( lines ) * 100.0 / curve[0]->accesses );
+		printf( "\n" );
+	}
+}
+
+bool MissRatioAnalysis::Write( const char* fileName )
+{
+	FILE* f = fopen( fileName, "w" );
+	if (!f) return false;
+	fprintf( f, "sets,ways,bytes,accesses,misses,missratio\n" );
+	for (int i = 0; i < count; i++)
+	{
+		const MissRatioCurve* c = curve[i];
+		std::vector<unsigned long long> misses( c->maxWays + 1 );
+		c->MissCurve( &misses[0] );
+		for (int w = 1; w <= c->maxWays; w++)
+			fprintf( f, "%i,%i,%i,%llu,%llu,%f\n", c->sets, w, c->sets * w * lineSize, c->accesses, misses[w],
+				c->accesses ? (double)misses[w] / c->accesses : 0.0 );
+	}
+	fclose( f );
+	return true;
+}
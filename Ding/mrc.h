@@ -0,0 +1,61 @@
+#pragma once
+
+// ------------------------------------------------------------------
+// MISS-RATIO CURVES
+// Mattson stack-distance analysis: in an LRU cache, an access hits
+// iff fewer than 'ways' distinct lines of its set were used since the
+// previous access to the same line. One pass over an access stream
+// therefore gives the LRU miss ratio of every associativity at once,
+// for every set mapping tracked (1 set = fully associative).
+// ------------------------------------------------------------------
+
+#define MRCMINSIZE		1024					// smallest capacity in the summary table, in bytes
+#define MRCMAXSIZE		(1024 * 1024)			// largest capacity analyzed, in bytes
+
+// LRU stack of one set: access times in a Fenwick tree, with a mark at
+// the most recent access of every line, so a distance is a range count
+class StackDistance
+{
+public:
+	StackDistance() : now( 0 ) {}
+	// distinct other lines used since the previous access to line; -1 on the first access
+	int Access( uint line );
+private:
+	void Add( int t, int v ) { for (t++; t < (int)tree.size(); t += t & -t) tree[t] += v; }
+	int Count( int t ) { int c = 0; for (; t > 0; t -= t & -t) c += tree[t]; return c; } // marks in [0, t)
+	void Renumber();
+	std::vector<int> tree;					// 1-based Fenwick tree over times [0, tree.size() - 1)
+	std::unordered_map<uint, int> last;		// line -> time of its most recent access
+	int now;
+};
+
+// stack distance histogram of one set mapping
+class MissRatioCurve
+{
+public:
+	MissRatioCurve( int sets, int maxWays );
+	~MissRatioCurve();
+	void Access( uint line );
+	// misses of an LRU cache with this mapping and 1..maxWays ways
+	unsigned long long Misses( int ways ) const;
+	void MissCurve( unsigned long long* misses ) const;	// misses[w] for all w = 1..maxWays at once
+	int sets, maxWays;
+	unsigned long long accesses, cold, beyond;	// cold: first touches; beyond: distance >= maxWays
+private:
+	StackDistance* stack;
+	std::vector<unsigned long long> hist;		// hist[d]: accesses at distance d < maxWays
+};
+
+// all set mappings with capacities in [lineSize, MRCMAXSIZE]
+class MissRatioAnalysis
+{
+public:
+	MissRatioAnalysis( int lineSize );
+	~MissRatioAnalysis();
+	void Access( address a ) { uint line = a >> lineShift; for (int i = 0; i < count; i++) curve[i]->Access( line ); }
+	void Replay( const TraceRecord* records, int count );
+	void Print();								// miss ratio per capacity (rows) and associativity (columns)
+	bool Write( const char* fileName );			// every capacity of every mapping, as CSV
+	int lineSize, lineShift, count;
+	MissRatioCurve* curve[32];					// curve[i]: 1 << i sets
+};
@@ -0,0 +1,48 @@
+#include "template.h"
+
+bool NextUse::Build( const char* traceFile, int lineSize )
+{
+	TraceReader reader;
+	if (!reader.Open( traceFile )) return false;
+	lineShift = 0;
+	while ((1 << lineShift) < lineSize) lineShift++;
+	// pass 1: the line of every access, with addresses wrapped as Hierarchy::Replay does
+	std::vector<uint> lines;
+	TraceRecord* records = new TraceRecord[REPLAYCHUNK];
+	int n;
+	while ((n = reader.Read( records, REPLAYCHUNK )) > 0)
+		for (int i = 0; i < n; i++) lines.push_back( (records[i].a & (RAMSIZE - 1)) >> lineShift );
+	delete[] records;
+	if (n < 0) return false;
+	// pass 2, backwards: the next access to each line is the last one seen so far
+	delete[] next;
+	count = (uint)lines.size();
+	next = new uint[count ? count : 1];
+	std::vector<uint> last( RAMSIZE >> lineShift, NEVER );
+	for (uint i = count; i-- > 0;)
+	{
+		next[i] = last[lines[i]];
+		last[lines[i]] = i;
+	}
+	return true;
+}
+
+BeladyOracle::BeladyOracle( const NextUse* _Uses )
+{
+	uses = _Uses;
+	lineShift = uses->lineShift;
+	lineNext = new uint[RAMSIZE >> lineShift];
+	for (int i = 0; i < (RAMSIZE >> lineShift); i++) lineNext[i] = NEVER;
+	time = 0;
+}
+
+bool UsesOPT( const HierarchyConfig& config )
+{
+	for (int i = 0; i < config.levels; i++) if (config.level[i].policy == EV_OPT) return true;
+	return false;
+}
+
+void SetOPT( HierarchyConfig& config )
+{
+	for (int i = 0; i < config.levels; i++) config.level[i].policy = EV_OPT;
+}
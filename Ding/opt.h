@@ -0,0 +1,46 @@
+#pragma once
+
+// ------------------------------------------------------------------
+// BELADY OPT
+// The optimal replacement policy (Belady, 1966) evicts the line that
+// is used again furthest in the future, which needs the future: it
+// only runs on a recorded trace, in two passes. NextUse scans the
+// trace once and stores, per access, when its line is accessed next;
+// during the replay a BeladyOracle follows along and answers, for any
+// line, when it is needed next. Levels configured with policy = opt
+// evict by those times. Every level uses the next-use times of the
+// L1 access stream; that is exact for L1 and the usual bound for the
+// levels below, whose own streams are filtered by the levels above.
+// Lines are always filled (no bypass), like the other policies.
+// ------------------------------------------------------------------
+
+#define NEVER			0xFFFFFFFF				// next use of a line that is not accessed again
+
+class NextUse
+{
+public:
+	NextUse() : next( 0 ), count( 0 ) {}
+	~NextUse() { delete[] next; }
+	bool Build( const char* traceFile, int lineSize );	// false if the trace can't be read completely
+	uint* next;								// per access: index of the next access to the same line, or NEVER
+	uint count;
+	int lineShift;
+};
+
+class BeladyOracle
+{
+public:
+	BeladyOracle( const NextUse* uses );
+	~BeladyOracle() { delete[] lineNext; }
+	// the next access of the trace, at byte address a; call before the caches see it
+	void Access( address a ) { lineNext[a >> lineShift] = time < uses->count ? uses->next[time] : NEVER; time++; }
+	uint Next( address tag ) const { return lineNext[tag >> lineShift]; }
+private:
+	const NextUse* uses;
+	uint* lineNext;							// per RAM line: index of its next access
+	uint time;
+	int lineShift;
+};
+
+bool UsesOPT( const HierarchyConfig& config );		// true if any level evicts by OPT
+void SetOPT( HierarchyConfig& config );				// put every level on OPT
@@ -0,0 +1,449 @@
+#pragma once
+
+// ------------------------------------------------------------------
+// REPLACEMENT POLICIES
+// Each policy keeps its own per-line metadata (ages, use counts, ...)
+// for a cache of 'sets' x 'ways' lines. The cache calls:
+//   Access( set, tag, site )  first, for every access (site -1: not a
+//                      demand access, e.g. a writeback or a prefetch)
+//   Touch( set, way )  on a hit
+//   Fill( set, way )   when a line is inserted after a miss
+//   Victim( set )      to pick the way to evict from a full set; changes
+//                      nothing, the miss may still bypass the level
+//   Evict( set, way )  when that line is really evicted, before Fill
+// A CacheT specialized on a concrete policy calls these directly
+// (inlined); runtime-configured caches go through AnyPolicy.
+// ------------------------------------------------------------------
+
+#define RRPVMAX			3						// 2-bit re-reference prediction values
+#define BIMODALRATE		32						// bimodal insertion: 1 in BIMODALRATE fills is not distant
+#define DUELINGLEADERS	32						// leader sets per competing policy, at most
+#define DUELINGPERIOD	16						// ... and at most one per this many sets
+#define PSELMAX			1023					// 10-bit policy selection counter
+
+// set dueling (Qureshi et al., 2007): a few leader sets always use policy A,
+// as many always use B, and a miss in either moves the PSEL counter; the
+// other sets follow whichever policy is missing less
+class SetDueling
+{
+public:
+	void Init( int sets )
+	{
+		// one leader set of each policy per DUELINGPERIOD sets, so leaders stay a small
+		// fraction of any cache; a cache smaller than that still gets one of each
+		int leaders = sets / DUELINGPERIOD;
+		if (leaders > DUELINGLEADERS) leaders = DUELINGLEADERS;
+		if (leaders < 1) leaders = 1;
+		period = sets / leaders;
+		if (period < 2) period = 2;
+		psel = (PSELMAX + 1) / 2;
+	}
+	// on a miss in set; true if the fill should use policy B
+	bool Miss( int set )
+	{
+		int leader = set % period;
+		if (leader == 0) { if (psel < PSELMAX) psel++; return false; }
+		if (leader == 1) { if (psel > 0) psel--; return true; }
+		return psel > PSELMAX / 2;
+	}
+	int period, psel;
+};
+
+class ReplacementPolicy
+{
+public:
+	virtual ~ReplacementPolicy() {}
+	virtual void Init( const CacheConfig& config, int sets, int ways ) = 0;
+	virtual void Access( int set, address tag, int site ) {}
+	virtual void Touch( int set, int way ) = 0;
+	virtual void Fill( int set, int way ) = 0;
+	virtual int Victim( int set ) = 0;
+	virtual void Evict( int set, int way ) {}
+};
+
+// Least Recently Used: exact recency order per set, kept as a doubly linked list of ways
+// (head = most recently used, tail = least recently used); hits, fills and victim selection are O(1)
+class LRUPolicy : public ReplacementPolicy
+{
+public:
+	LRUPolicy() : prev( 0 ), next( 0 ), head( 0 ), tail( 0 ) {}
+	~LRUPolicy() { delete[] prev; delete[] next; delete[] head; delete[] tail; }
+	void Init( const CacheConfig& config, int sets, int ways )
+	{
+		nway = ways;
+		prev = new byte[sets * ways], next = new byte[sets * ways];
+		head = new byte[sets], tail = new byte[sets];
+		for (int s = 0; s < sets; s++)
+		{
+			// initial order: way 0 is the most recently used
+			for (int i = 0; i < ways; i++) prev[s * ways + i] = i - 1, next[s * ways + i] = i + 1;
+			head[s] = 0, tail[s] = ways - 1;
+		}
+	}
+	// move a way to the head of its set's list
+	void Touch( int set, int way )
+	{
+		if (head[set] == way) return;
+		byte* p = prev + set * nway, *n = next + set * nway;
+		// unlink (way is not the head, so it has a predecessor)
+		n[p[way]] = n[way];
+		if (tail[set] == way) tail[set] = p[way]; else p[n[way]] = p[way];
+		// push front
+		n[way] = head[set], p[head[set]] = way;
+		head[set] = way;
+	}
+	void Fill( int set, int way ) { Touch( set, way ); }
+	int Victim( int set ) { return tail[set]; }
+	// move a way to the tail, to be evicted next
+	void Demote( int set, int way )
+	{
+		if (tail[set] == way) return;
+		byte* p = prev + set * nway, *n = next + set * nway;
+		if (head[set] == way) head[set] = n[way]; else n[p[way]] = n[way];
+		p[n[way]] = p[way];
+		// push back
+		p[way] = tail[set], n[tail[set]] = way;
+		tail[set] = way;
+	}
+protected:
+	byte* prev, *next;				// per line: neighbours in the recency list of its set
+	byte* head, *tail;				// per set: most and least recently used way
+	int nway;
+};
+
+// Most Recently Used: same recency list as LRU, evicts the head
+class MRUPolicy : public LRUPolicy
+{
+public:
+	int Victim( int set ) { return head[set]; }
+};
+
+// Dynamic Insertion Policy (Qureshi et al., 2007): LRU order, but a fill either
+// goes to the MRU end (LRU) or, under the bimodal insertion policy, stays at the
+// LRU end unless it is the 1 in BIMODALRATE; a line only moves up when it is used
+// again, so a scan cannot flush the set. Set dueling picks one of the two.
+class DIPPolicy : public LRUPolicy
+{
+public:
+	void Init( const CacheConfig& config, int sets, int ways ) { LRUPolicy::Init( config, sets, ways ); dueling.Init( sets ); fills = 0; }
+	void Fill( int set, int way )
+	{
+		if (dueling.Miss( set ) && ++fills % BIMODALRATE) Demote( set, way );
+		else Touch( set, way );
+	}
+protected:
+	SetDueling dueling;
+	uint fills;
+};
+
+// tree pseudo-LRU: nway - 1 bits per set, one per node of a binary tree over the ways;
+// each bit points to the half that was used least recently. O(log nway) updates and victim walk.
+class PLRUPolicy : public ReplacementPolicy
+{
+public:
+	PLRUPolicy() : bits( 0 ) {}
+	~PLRUPolicy() { delete[] bits; }
+	void Init( const CacheConfig& config, int sets, int ways )
+	{
+		levels = 0;
+		while ((1 << levels) < ways) levels++;
+		bits = new uint[sets]();
+	}
+	void Touch( int set, int way )
+	{
+		// walk from the root (node 1) to the leaf, pointing every node away from this way
+		uint b = bits[set];
+		for (int l = levels - 1, node = 1; l >= 0; l--)
+		{
+			int right = (way >> l) & 1;
+			if (right) b &= ~(1u << node); else b |= 1u << node;
+			node = node * 2 + right;
+		}
+		bits[set] = b;
+	}
+	void Fill( int set, int way ) { Touch( set, way ); }
+	int Victim( int set )
+	{
+		// follow the bits to the pseudo-least recently used way
+		uint b = bits[set];
+		int node = 1, way = 0;
+		for (int l = 0; l < levels; l++)
+		{
+			int right = (b >> node) & 1;
+			way = way * 2 + right;
+			node = node * 2 + right;
+		}
+		return way;
+	}
+protected:
+	uint* bits;						// per set: tree nodes 1..nway-1 (bit 0 unused)
+	int levels;
+};
+
+// Least Frequently Used: per-line use count, saturating at 255 (it never decays:
+// once-hot lines stay; see LFUDAPolicy)
+class LFUPolicy : public ReplacementPolicy
+{
+public:
+	LFUPolicy() : uses( 0 ) {}
+	~LFUPolicy() { delete[] uses; }
+	void Init( const CacheConfig& config, int sets, int ways ) { nway = ways; uses = new byte[sets * ways](); }
+	void Touch( int set, int way ) { if (uses[set * nway + way] < 255) uses[set * nway + way]++; }
+	void Fill( int set, int way ) { uses[set * nway + way] = 1; }
+	int Victim( int set )
+	{
+		byte* u = uses + set * nway;
+		int v = 0;
+		for (int i = 1; i < nway; i++) if (u[i] < u[v]) v = i;
+		return v;
+	}
+protected:
+	byte* uses;
+	int nway;
+};
+
+// LFU with dynamic aging (Arlitt et al., 2000): a line's key is its use count plus
+// the age of its set when it was last used; evicting a line sets the age to its key.
+// Counts made long ago thus weigh less than recent ones, and a once-hot line that
+// is no longer used is eventually overtaken by newer lines.
+class LFUDAPolicy : public ReplacementPolicy
+{
+public:
+	LFUDAPolicy() : uses( 0 ), key( 0 ), age( 0 ) {}
+	~LFUDAPolicy() { delete[] uses; delete[] key; delete[] age; }
+	void Init( const CacheConfig& config, int sets, int ways )
+	{
+		nway = ways;
+		uses = new uint[sets * ways](), key = new uint[sets * ways]();
+		age = new uint[sets]();
+	}
+	void Touch( int set, int way ) { int i = set * nway + way; key[i] = age[set] + ++uses[i]; }
+	void Fill( int set, int way ) { int i = set * nway + way; uses[i] = 1, key[i] = age[set] + 1; }
+	int Victim( int set )
+	{
+		uint* k = key + set * nway;
+		int v = 0;
+		for (int i = 1; i < nway; i++) if (k[i] < k[v]) v = i;
+		return v;
+	}
+	void Evict( int set, int way ) { age[set] = key[set * nway + way]; }
+protected:
+	uint* uses, *key;						// per line
+	uint* age;								// per set
+	int nway;
+};
+
+// Re-Reference Interval Prediction (Jaleel et al., 2010): a 2-bit prediction
+// per line; hits predict a near re-reference (0), the victim is a line predicted
+// distant (RRPVMAX), ageing the whole set until there is one. SRRIP inserts at
+// RRPVMAX - 1, so new lines must prove themselves before older reused ones go.
+class SRRIPPolicy : public ReplacementPolicy
+{
+public:
+	SRRIPPolicy() : rrpv( 0 ) {}
+	~SRRIPPolicy() { delete[] rrpv; }
+	void Init( const CacheConfig& config, int sets, int ways ) { nway = ways; rrpv = new byte[sets * ways]; memset( rrpv, RRPVMAX, sets * ways ); }
+	void Touch( int set, int way ) { rrpv[set * nway + way] = 0; }
+	void Fill( int set, int way ) { rrpv[set * nway + way] = RRPVMAX - 1; }
+	int Victim( int set )
+	{
+		byte* r = rrpv + set * nway;
+		int v = 0;
+		for (int i = 1; i < nway; i++) if (r[i] > r[v]) v = i;
+		return v;
+	}
+	// age the set until the victim is predicted distant
+	void Evict( int set, int way )
+	{
+		byte* r = rrpv + set * nway;
+		byte d = RRPVMAX - r[way];
+		for (int i = 0; i < nway; i++) r[i] += d;
+	}
+protected:
+	byte* rrpv;
+	int nway;
+};
+
+// bimodal RRIP: insert at RRPVMAX (evicted next, unless used) but for 1 in BIMODALRATE fills;
+// resists scans and thrashing working sets larger than the cache
+class BRRIPPolicy : public SRRIPPolicy
+{
+public:
+	BRRIPPolicy() : fills( 0 ) {}
+	void Fill( int set, int way ) { rrpv[set * nway + way] = ++fills % BIMODALRATE ? RRPVMAX : RRPVMAX - 1; }
+protected:
+	uint fills;
+};
+
+// dynamic RRIP: SRRIP and BRRIP compete through set dueling
+class DRRIPPolicy : public BRRIPPolicy
+{
+public:
+	void Init( const CacheConfig& config, int sets, int ways ) { SRRIPPolicy::Init( config, sets, ways ); dueling.Init( sets ); }
+	void Fill( int set, int way ) { if (dueling.Miss( set )) BRRIPPolicy::Fill( set, way ); else SRRIPPolicy::Fill( set, way ); }
+protected:
+	SetDueling dueling;
+};
+
+// ------------------------------------------------------------------
+// Hawkeye (Jain & Lin, 2016): learns from OPT what to keep. On a few
+// sampled sets, OPTgen replays the recent accesses and decides, for
+// every reuse, whether OPT would have hit: it would if the set had a
+// free way at every step since the previous access. The outcome
+// trains a 3-bit counter of the site that made the previous access
+// (sites are the Get/Set call sites in Subdivide; without one, the
+// 4KB region; writebacks and prefetches share one counter). Lines of
+// sites predicted cache-friendly enter at age 0 and age the other
+// friendly lines, RRIP-style, but with byte ages rather than 3 bits,
+// so 16-way sets keep an order; cache-averse lines go first. Evicting
+// a friendly line detrains the site that brought it in.
+// ------------------------------------------------------------------
+#define HAWKEYETABLE	256						// predictor counters (a power of two)
+#define HAWKEYEMAX		7						// 3-bit counters; friendly above HAWKEYEMAX / 2
+#define HAWKEYEAVERSE	255						// age of cache-averse lines; friendly ones age up to one less
+#define HAWKEYESAMPLED	16						// sampled sets, at most
+#define HAWKEYEHISTORY	8						// OPTgen history per sampled set, in multiples of the associativity
+
+class HawkeyePolicy : public ReplacementPolicy
+{
+public:
+	HawkeyePolicy() : rrpv( 0 ), lineKey( 0 ), history( 0 ), time( 0 ) {}
+	~HawkeyePolicy() { delete[] rrpv; delete[] lineKey; delete[] history; delete[] time; }
+	void Init( const CacheConfig& config, int sets, int ways )
+	{
+		nway = ways;
+		rrpv = new byte[sets * ways];
+		memset( rrpv, HAWKEYEAVERSE, sets * ways );
+		lineKey = new byte[sets * ways]();
+		period = sets > HAWKEYESAMPLED ? sets / HAWKEYESAMPLED : 1;
+		length = HAWKEYEHISTORY * ways;
+		int sampled = (sets + period - 1) / period;
+		history = new Quantum[sampled * length];
+		for (int i = 0; i < sampled * length; i++) history[i].tag = INVALIDTAG;
+		time = new uint[sampled]();
+		for (int i = 0; i < HAWKEYETABLE; i++) counter[i] = (HAWKEYEMAX + 1) / 2;
+		key = 0;
+	}
+	void Access( int set, address tag, int site )
+	{
+		// writebacks and prefetches share one entry: OPTgen learns whether to keep them too
+		uint k = site > 0 ? (uint)site : site < 0 ? 0x20000 : 0x10000 | (tag >> 12);
+		key = (byte)((k * 2654435761u) >> 24) & (HAWKEYETABLE - 1);
+		if (set % period == 0) Sample( set / period, tag );
+	}
+	void Touch( int set, int way )
+	{
+		rrpv[set * nway + way] = Friendly() ? 0 : HAWKEYEAVERSE;
+		lineKey[set * nway + way] = key;
+	}
+	void Fill( int set, int way )
+	{
+		byte* r = rrpv + set * nway;
+		lineKey[set * nway + way] = key;
+		if (!Friendly()) { r[way] = HAWKEYEAVERSE; return; }
+		for (int i = 0; i < nway; i++) if (r[i] < HAWKEYEAVERSE - 1) r[i]++;
+		r[way] = 0;
+	}
+	int Victim( int set )
+	{
+		byte* r = rrpv + set * nway;
+		int v = 0;
+		for (int i = 0; i < nway; i++)
+		{
+			if (r[i] == HAWKEYEAVERSE) return i;
+			if (r[i] > r[v]) v = i;
+		}
+		return v;
+	}
+	void Evict( int set, int way )
+	{
+		// a friendly line goes (there was no averse one): its site was wrong about it
+		int i = set * nway + way;
+		if (rrpv[i] != HAWKEYEAVERSE) Train( lineKey[i], false );
+	}
+protected:
+	struct Quantum
+	{
+		address tag;						// line accessed at this time step
+		byte key;							// its predictor entry
+		byte occupancy;						// lines OPT keeps cached across this step
+		bool reused;						// a later access in the history found it
+	};
+	bool Friendly() { return counter[key] > HAWKEYEMAX / 2; }
+	void Train( int k, bool keep )
+	{
+		if (keep) { if (counter[k] < HAWKEYEMAX) counter[k]++; }
+		else if (counter[k] > 0) counter[k]--;
+	}
+	// OPTgen on one sampled set
+	void Sample( int s, address tag )
+	{
+		Quantum* h = history + s * length;
+		uint now = time[s]++;
+		uint limit = now < (uint)length ? now : length - 1;
+		uint d = 1;
+		while (d <= limit && h[(now - d) % length].tag != tag) d++;
+		if (d <= limit)
+		{
+			Quantum& previous = h[(now - d) % length];
+			previous.reused = true;
+			bool hit = true;
+			for (uint i = 1; i <= d && hit; i++) if (h[(now - i) % length].occupancy >= nway) hit = false;
+			if (hit) for (uint i = 1; i <= d; i++) h[(now - i) % length].occupancy++;
+			Train( previous.key, hit );
+		}
+		// the oldest step leaves the history: a line not used again within it would not have been kept
+		Quantum& q = h[now % length];
+		if (q.tag != INVALIDTAG && !q.reused) Train( q.key, false );
+		q.tag = tag, q.key = key, q.occupancy = 0, q.reused = false;
+	}
+	byte* rrpv, *lineKey;					// per line
+	Quantum* history;						// per sampled set: the last 'length' accesses, a ring
+	uint* time;								// per sampled set: accesses so far
+	byte counter[HAWKEYETABLE];
+	int nway, period, length;
+	byte key;								// predictor entry of the current access, see Access
+};
+
+// random replacement; uses a private generator so the workload's rand() sequence is not disturbed
+class RandomPolicy : public ReplacementPolicy
+{
+public:
+	void Init( const CacheConfig& config, int sets, int ways ) { nway = ways; seed = 0x12345678; }
+	void Touch( int set, int way ) {}
+	void Fill( int set, int way ) {}
+	int Victim( int set ) { return Next() % nway; }
+	void Evict( int set, int way ) { seed = Next(); }
+protected:
+	uint Next() { uint s = seed; s ^= s << 13, s ^= s >> 17, s ^= s << 5; return s; }
+	uint seed;
+	int nway;
+};
+
+// always overwrite the first slot
+class ConstPolicy : public ReplacementPolicy
+{
+public:
+	void Init( const CacheConfig& config, int sets, int ways ) {}
+	void Touch( int set, int way ) {}
+	void Fill( int set, int way ) {}
+	int Victim( int set ) { return 0; }
+};
+
+ReplacementPolicy* CreatePolicy( EvictionPolicy policy );
+
+// type-erased policy for caches configured at runtime
+class AnyPolicy
+{
+public:
+	AnyPolicy() : policy( 0 ) {}
+	~AnyPolicy() { delete policy; }
+	void Init( const CacheConfig& config, int sets, int ways ) { policy = CreatePolicy( config.policy ); policy->Init( config, sets, ways ); }
+	void Access( int set, address tag, int site ) { policy->Access( set, tag, site ); }
+	void Touch( int set, int way ) { policy->Touch( set, way ); }
+	void Fill( int set, int way ) { policy->Fill( set, way ); }
+	int Victim( int set ) { return policy->Victim( set ); }
+	void Evict( int set, int way ) { policy->Evict( set, way ); }
+private:
+	ReplacementPolicy* policy;
+};
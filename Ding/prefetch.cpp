@@ -0,0 +1,137 @@
+#include "template.h"
+
+Prefetcher::Prefetcher( const CacheConfig& config, int lineSize )
+{
+	degree = config.degree;
+	distance = config.distance;
+	lineShift = 0;
+	while ((1 << lineShift) < lineSize) lineShift++;
+	lineMask = ~(address)(lineSize - 1);
+	queued = next = 0;
+}
+
+bool Prefetcher::Pop( address& a )
+{
+	if (next == queued)
+	{
+		queued = next = 0;
+		return false;
+	}
+	a = queue[next++];
+	return true;
+}
+
+// ------------------------------------------------------------------
+// NEXT-LINE
+// ------------------------------------------------------------------
+
+void NextLinePrefetcher::Train( address a, int site, bool hit, bool prefetched )
+{
+	// tagged: plain hits do not trigger, so a run of prefetched lines keeps itself going
+	if (hit && !prefetched) return;
+	address line = a >> lineShift;
+	for (int i = 0; i < degree; i++) Queue( (line + distance + i) << lineShift );
+}
+
+// ------------------------------------------------------------------
+// STRIDE
+// After Chen & Baer's reference prediction table; the diamond-square
+// sites step by the task's scale, in x or in 513-byte rows.
+// ------------------------------------------------------------------
+
+StridePrefetcher::StridePrefetcher( const CacheConfig& config, int lineSize, bool _ByRegion ) : Prefetcher( config, lineSize )
+{
+	byRegion = _ByRegion;
+	for (int i = 0; i < STRIDETABLE; i++) table[i].key = 0xFFFFFFFF, table[i].last = 0, table[i].stride = table[i].confidence = 0;
+}
+
+void StridePrefetcher::Train( address a, int site, bool hit, bool prefetched )
+{
+	uint key = byRegion ? a >> STRIDEREGION : (uint)site;
+	Entry& e = table[((key * 2654435761u) >> 16) % STRIDETABLE];
+	if (e.key != key)
+	{
+		e.key = key, e.last = a, e.stride = e.confidence = 0;
+		return;
+	}
+	int stride = (int)(a - e.last);
+	if (stride == 0) return; // same element again (read, then write)
+	if (stride == e.stride) { if (e.confidence < 3) e.confidence++; }
+	else if (e.confidence > 0) e.confidence--;
+	else e.stride = stride;
+	e.last = a;
+	if (e.confidence < 2) return;
+	for (int i = 0; i < degree; i++) Queue( a + e.stride * (distance + i) );
+}
+
+// ------------------------------------------------------------------
+// STREAM BUFFERS
+// After Jouppi (1990) and Palacharla & Kessler (1994), except that
+// the lines go into the cache itself rather than into separate FIFOs,
+// so all prefetchers share the same accounting.
+// ------------------------------------------------------------------
+
+StreamPrefetcher::StreamPrefetcher( const CacheConfig& config, int lineSize ) : Prefetcher( config, lineSize )
+{
+	streams = time = 0;
+}
+
+void StreamPrefetcher::Train( address a, int site, bool hit, bool prefetched )
+{
+	// streams follow misses, and the first uses of the lines they brought in
+	if (hit && !prefetched) return;
+	int line = (int)(a >> lineShift);
+	time++;
+	Stream* s = 0;
+	for (int i = 0; i < streams && !s; i++)
+	{
+		Stream& c = stream[i];
+		// close to the last access, or inside the range the stream already queued
+		if (abs( line - c.last ) <= STREAMWINDOW || ((line - c.last) * c.direction > 0 && (c.head - line) * c.direction >= 0)) s = &c;
+	}
+	if (!s)
+	{
+		// allocate a new stream in the least recently used buffer
+		if (streams < MAXSTREAMS) s = &stream[streams++]; else
+		{
+			s = &stream[0];
+			for (int i = 1; i < MAXSTREAMS; i++) if (stream[i].used < s->used) s = &stream[i];
+		}
+		s->last = s->head = line;
+		s->direction = s->confidence = 0;
+		s->used = time;
+		return;
+	}
+	s->used = time;
+	int direction = line > s->last ? 1 : line < s->last ? -1 : 0;
+	if (!direction) return;
+	if (direction == s->direction) s->confidence++; else
+	{
+		// (new) direction: restart the run-ahead from here
+		s->direction = direction, s->confidence = 0;
+		s->head = line;
+	}
+	s->last = line;
+	if (s->confidence < 1) return;
+	// stay up to distance lines ahead of the accesses, degree lines per trigger
+	int from = (s->head - line) * direction > 0 ? s->head : line;
+	for (int i = 0; i < degree && (from + direction - line) * direction <= distance; i++)
+	{
+		from += direction;
+		if (from < 0) break;
+		Queue( (address)from << lineShift );
+	}
+	s->head = from;
+}
+
+Prefetcher* CreatePrefetcher( const CacheConfig& config, int lineSize )
+{
+	switch (config.prefetch)
+	{
+	case PF_NEXTLINE: return new NextLinePrefetcher( config, lineSize );
+	case PF_STRIDE: return new StridePrefetcher( config, lineSize, false );
+	case PF_REGION: return new StridePrefetcher( config, lineSize, true );
+	case PF_STREAM: return new StreamPrefetcher( config, lineSize );
+	default: return 0;
+	}
+}
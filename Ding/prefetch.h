@@ -0,0 +1,89 @@
+#pragma once
+
+// ------------------------------------------------------------------
+// HARDWARE PREFETCHERS
+// A prefetcher watches the demand accesses of one cache level and
+// queues lines to fetch ahead of use; the cache fills them before its
+// next access (CacheT::IssuePrefetches), without advancing the
+// simulated clock, and counts useful, late, unused and polluting
+// prefetches (Cache::Observe). Selected per level in the config:
+//   l2.prefetch = stride    l2.degree = 2    l2.distance = 4
+//   next:    tagged next-line: a miss, or the first use of a
+//            prefetched line, queues the lines distance.. ahead
+//   stride:  reference prediction table indexed by access site; once
+//            a site repeats its stride, queue distance.. strides ahead
+//   region:  the same, indexed by 4KB region instead of site
+//   stream:  stream buffers: misses close together allocate a stream;
+//            once it has a direction, it runs up to distance lines
+//            ahead of the accesses, degree lines at a time
+// degree: lines queued per trigger.
+// ------------------------------------------------------------------
+
+#define MAXPREFETCHDEGREE	16
+#define MAXPREFETCHDISTANCE	64
+#define STRIDETABLE		64		// reference prediction table entries
+#define STRIDEREGION	12		// log2 of the region size of region-indexed strides
+#define MAXSTREAMS		16		// stream buffers per cache
+#define STREAMWINDOW	16		// lines from a stream's last access that still belong to it
+
+class Prefetcher
+{
+public:
+	Prefetcher( const CacheConfig& config, int lineSize );
+	virtual ~Prefetcher() {}
+	// a demand access: a is a byte address at L1, a line address below. hit: the line was
+	// cached; prefetched: it was brought in by a prefetch, and this is its first use
+	virtual void Train( address a, int site, bool hit, bool prefetched ) = 0;
+	bool Pop( address& a );				// next queued line, in order
+protected:
+	void Queue( address a ) { if (queued < MAXPREFETCHDEGREE) queue[queued++] = a & lineMask; }
+	address queue[MAXPREFETCHDEGREE];
+	int queued, next;
+	int degree, distance, lineShift;
+	address lineMask;
+};
+
+class NextLinePrefetcher : public Prefetcher
+{
+public:
+	NextLinePrefetcher( const CacheConfig& config, int lineSize ) : Prefetcher( config, lineSize ) {}
+	void Train( address a, int site, bool hit, bool prefetched );
+};
+
+// stride per site or per region; 2-bit confidence per entry: a matching
+// stride counts up, a different one counts down, and replaces the stride at 0
+class StridePrefetcher : public Prefetcher
+{
+public:
+	StridePrefetcher( const CacheConfig& config, int lineSize, bool byRegion );
+	void Train( address a, int site, bool hit, bool prefetched );
+private:
+	struct Entry
+	{
+		uint key;
+		address last;
+		int stride, confidence;
+	};
+	Entry table[STRIDETABLE];
+	bool byRegion;
+};
+
+class StreamPrefetcher : public Prefetcher
+{
+public:
+	StreamPrefetcher( const CacheConfig& config, int lineSize );
+	void Train( address a, int site, bool hit, bool prefetched );
+private:
+	struct Stream
+	{
+		int last, head;					// line of the last access; last line queued
+		int direction, confidence;		// +1 / -1 (0: not known yet); accesses that agreed
+		uint used;						// for LRU replacement
+	};
+	Stream stream[MAXSTREAMS];
+	int streams;
+	uint time;
+};
+
+// NULL for PF_NONE
+Prefetcher* CreatePrefetcher( const CacheConfig& config, int lineSize );
@@ -47,6 +47,10 @@ Surface::Surface( char* a_File ) :
 
 void Surface::LoadImage( char* a_File )
 {
+#ifdef HEADLESS
+	// the batch driver draws nothing, and links without FreeImage
+	NotifyUser( "no image loading in headless builds" );
+#else
 	FREE_IMAGE_FORMAT fif = FIF_UNKNOWN;
 	fif = FreeImage_GetFileType( a_File, 0 );
 	if (fif == FIF_UNKNOWN) fif = FreeImage_GetFIFFromFilename( a_File );
@@ -63,6 +67,7 @@ void Surface::LoadImage( char* a_File )
 		memcpy( m_Buffer + y * m_Pitch, line, m_Width * sizeof( Pixel ) );
 	}
 	FreeImage_Unload( dib );
+#endif
 }
 
 Surface::~Surface()
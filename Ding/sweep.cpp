@@ -0,0 +1,131 @@
+#include "template.h"
+
+void SweepJob::Main()
+{
+	Hierarchy* hierarchy;
+	done = Replay( config, hierarchy );
+	// keep the numbers, not the hierarchy: a sweep can have many configurations
+	cycles = hierarchy->clock.cycles;
+	for (int i = 0; i < config.levels; i++) hierarchy->Totals( i, hits[i], misses[i] );
+	ramReads = hierarchy->memory->reads, ramWrites = hierarchy->memory->writes;
+	delete hierarchy;
+	if (!done || !opt) return;
+	HierarchyConfig c = config;
+	SetOPT( c );
+	done = Replay( c, hierarchy );
+	optCycles = hierarchy->clock.cycles;
+	delete hierarchy;
+}
+
+// the whole trace through a new hierarchy; false if the trace could not be read to the end
+bool SweepJob::Replay( const HierarchyConfig& c, Hierarchy*& hierarchy )
+{
+	hierarchy = new Hierarchy( c );
+	if (uses) hierarchy->SetNextUse( uses );
+	TraceReader reader;
+	if (!reader.Open( traceFile )) return false;
+	TraceRecord* records = new TraceRecord[REPLAYCHUNK];
+	accesses = 0;
+	int count;
+	while ((count = reader.Read( records, REPLAYCHUNK )) > 0)
+	{
+		hierarchy->Replay( records, count );
+		accesses += count;
+	}
+	hierarchy->UpdateStats();
+	delete[] records;
+	return count == 0;
+}
+
+Sweep::~Sweep()
+{
+	for (size_t i = 0; i < jobs.size(); i++) delete jobs[i];
+}
+
+bool Sweep::Load( const char* fileName, const HierarchyConfig& base )
+{
+	FILE* f = fopen( fileName, "r" );
+	if (!f) return false;
+	char line[1024];
+	while (fgets( line, sizeof( line ), f ))
+	{
+		if (char* comment = strchr( line, '#' )) *comment = 0;
+		// split into key=values tokens
+		char* keys[32], *values[32];
+		int count = 0;
+		for (char* token = strtok( line, " \t\r\n" ); token; token = strtok( 0, " \t\r\n" ))
+		{
+			char* eq = strchr( token, '=' );
+			if (!eq || count == 32) { printf( "ignoring '%s' in %s\n", token, fileName ); continue; }
+			*eq = 0;
+			keys[count] = token, values[count++] = eq + 1;
+		}
+		if (count) Expand( base, keys, values, count, "" );
+	}
+	fclose( f );
+	return true;
+}
+
+void Sweep::Expand( const HierarchyConfig& config, char** keys, char** values, int count, const char* description )
+{
+	if (count == 0)
+	{
+		HierarchyConfig c = config;
+		if (!c.Validate()) { printf( "skipping invalid configuration:%s\n", description ); return; }
+		SweepJob* job = new SweepJob();
+		job->config = c;
+		strncpy( job->description, description[0] ? description + 1 : "(base)", MAXSWEEPTEXT - 1 );
+		job->description[MAXSWEEPTEXT - 1] = 0;
+		jobs.push_back( job );
+		return;
+	}
+	// one branch per value of the first key
+	char list[256];
+	strncpy( list, values[0], sizeof( list ) - 1 );
+	list[sizeof( list ) - 1] = 0;
+	for (char* value = list, *next; value; value = next)
+	{
+		if ((next = strchr( value, ',' ))) *next++ = 0;
+		HierarchyConfig c = config;
+		if (!c.Set( keys[0], value )) continue;
+		char text[2048]; // lines are at most 1024 characters
+		sprintf( text, "%s %s=%s", description, keys[0], value );
+		Expand( c, keys + 1, values + 1, count - 1, text );
+	}
+}
+
+void Sweep::Run( const char* traceFile, const std::vector<NextUse*>& uses, bool opt )
+{
+	JobManager* manager = JobManager::GetJobManager();
+	for (size_t i = 0; i < jobs.size(); i++)
+	{
+		jobs[i]->traceFile = traceFile, jobs[i]->uses = 0, jobs[i]->opt = opt;
+		for (size_t u = 0; u < uses.size(); u++) if (1 << uses[u]->lineShift == jobs[i]->config.lineSize) jobs[i]->uses = uses[u];
+		manager->AddJob2( jobs[i] );
+	}
+	manager->RunJobs();
+}
+
+void Sweep::Print()
+{
+	bool opt = !jobs.empty() && jobs[0]->opt;
+	printf( "%-48s %14s %8s %8s %8s %10s", "configuration", "cycles", "L1 hit", "L2 hit", "L3 hit", "RAM reads" );
+	if (opt) printf( " %14s %8s", "OPT cycles", "OPT gap" );
+	printf( "\n" );
+	int best = -1;
+	for (int i = 0; i < (int)jobs.size(); i++)
+	{
+		SweepJob* job = jobs[i];
+		if (!job->done) { printf( "%-48s failed to replay the trace\n", job->description ); continue; }
+		printf( "%-48s %14llu", job->description, job->cycles );
+		for (int l = 0; l < MAXLEVELS; l++)
+			if (l >= job->config.levels) printf( " %8s", "-" );
+			else printf( " %7.3f%%", job->hits[l] * 100.0 / (job->hits[l] + job->misses[l] ? job->hits[l] + job->misses[l] : 1) );
+		printf( " %10i", job->ramReads );
+		// the gap: how much more the configured policies cost than OPT
+		if (opt) printf( " %14llu %7.2f%%", job->optCycles, job->optCycles ? (job->cycles * 100.0 / job->optCycles - 100) : 0.0 );
+		printf( "\n" );
+		if (best < 0 || job->cycles < jobs[best]->cycles) best = i;
+	}
+	if (best >= 0) printf( "lowest cost: %s (%llu cycles)\n", jobs[best]->description, jobs[best]->cycles );
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+// ------------------------------------------------------------------
+// CONFIGURATION SWEEPS
+// Replays one trace through many hierarchies at once: every
+// configuration is a Job on the JobManager, with its own RAM, caches
+// and trace reader, so all cores stay busy. A sweep file lists one
+// configuration per line, as key=value overrides of the base
+// configuration; a comma-separated list of values expands to all
+// combinations:
+//   l1.size=4096,8192,16384 l1.ways=2,4,8      # 9 configurations
+//   levels=2 l2.policy=lru,plru                # 2 more
+// With opt=1 every configuration also runs with all levels on OPT.
+// Next-use times are per line, so the configurations of each line
+// size share one next-use pass over the trace (see opt.h).
+// ------------------------------------------------------------------
+
+#define MAXSWEEPTEXT	256
+
+class SweepJob : public Tmpl8::Job
+{
+public:
+	void Main();
+	HierarchyConfig config;
+	const char* traceFile;
+	const NextUse* uses;					// next-use times of the trace, if a level or the comparison needs OPT
+	bool opt;								// also replay with every level on OPT
+	char description[MAXSWEEPTEXT];			// the overrides of the base configuration
+	// results
+	bool done;
+	unsigned long long accesses, cycles;
+	int hits[MAXLEVELS], misses[MAXLEVELS], ramReads, ramWrites;
+	unsigned long long optCycles;
+private:
+	bool Replay( const HierarchyConfig& c, Hierarchy*& hierarchy );
+};
+
+class Sweep
+{
+public:
+	~Sweep();
+	bool Load( const char* fileName, const HierarchyConfig& base );
+	// the JobManager must exist; uses: the next-use times for each line size in the sweep, if any job needs OPT
+	void Run( const char* traceFile, const std::vector<NextUse*>& uses, bool opt = false );
+	void Print();
+	std::vector<SweepJob*> jobs;
+private:
+	void Expand( const HierarchyConfig& config, char** keys, char** values, int count, const char* description );
+};
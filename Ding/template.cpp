@@ -15,8 +15,12 @@
 namespace Tmpl8 { 
 void NotifyUser( char* s )
 {
+#ifdef _WIN32
 	HWND hApp = FindWindow( NULL, "Template" );
 	MessageBox( hApp, s, "ERROR", MB_OK );
+#else
+	printf( "ERROR: %s\n", s );
+#endif
 	exit( 0 );
 }
 }
@@ -28,16 +32,9 @@ static bool FULLSCREEN = false, firstframe = true;
 Surface* surface = 0;
 Game* game = 0;
 float lastftime = 0;
-LARGE_INTEGER lasttime, ticksPS;
 double Timer::inv_freq = 1;
-Timer delayTimer;
-
-void delay()
-{
-	delayTimer.reset();
-	while (delayTimer.elapsed() < 0.0001f) {};
-}
-
+#ifdef _WIN32
+LARGE_INTEGER lasttime, ticksPS;
 float GetTime()
 {
 	LARGE_INTEGER freq, value;
@@ -63,6 +60,9 @@ float GetDuration()
 	elapsed = value.QuadPart - startTime;
 	return (float)((double)elapsed / (double)freq.QuadPart);
 }
+#endif
+
+#ifndef HEADLESS
 
 void redirectIO()
 {
@@ -109,8 +109,14 @@ int main( int argc, char **argv )
 	SDL_Renderer* renderer = SDL_CreateRenderer( window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC );
 	SDL_Texture* frameBuffer = SDL_CreateTexture( renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, SCRWIDTH, SCRHEIGHT );
 	int exitapp = 0;
+	// cache hierarchy: defaults, then cache.cfg (if present), then key=value arguments
+	HierarchyConfig config;
+	config.Load( "cache.cfg" );
+	if (!config.Parse( argc, argv ) || !config.Validate()) NotifyUser( "invalid cache configuration (see console)" );
+	config.Print();
 	game = new Game();
 	game->SetTarget( surface );
+	game->SetConfig( config );
 	while (!exitapp) 
 	{
 		void* target = 0;
@@ -178,4 +184,6 @@ int main( int argc, char **argv )
 	game->Shutdown();
 	SDL_Quit();
 	return 1;
-}
\ No newline at end of file
+}
+
+#endif // HEADLESS
\ No newline at end of file
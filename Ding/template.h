@@ -10,27 +10,58 @@ typedef unsigned char uchar;
 #include "stdlib.h"
 #include "emmintrin.h"
 #include "stdio.h"
+#ifdef _WIN32
 #include "windows.h"
+#else
+// the headless batch driver also builds elsewhere (see Makefile)
+#include <string.h>
+#include <chrono>
+typedef unsigned char byte;
+typedef short __int16;
+typedef int __int32;
+typedef long long __int64;
+#endif
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 #include "surface.h"
 #include "cache.h"
+#include "policy.h"
+#include "prefetch.h"
+#include "coherence.h"
+#include "trace.h"
+#include "mrc.h"
+#include "opt.h"
 #include "game.h"
-#include <vector>
+#ifndef HEADLESS
 #include "freeimage.h"
+#endif
 #include "threads.h"
+#include "sweep.h"
 
+#ifndef HEADLESS
 extern "C" 
 { 
 #include "glew.h" 
 }
 #include "gl.h"
+#endif
+#ifdef _WIN32
 #include "io.h"
+#endif
 #include <ios>
 #include <iostream>
 #include <fstream>
 #include <stdio.h>
+#ifndef HEADLESS
 #include "SDL.h"
 #include "SDL_syswm.h"
 #include "wglext.h"
+#endif
 #include "fcntl.h"
 
 using namespace Tmpl8;				// to use template classes
@@ -39,15 +70,20 @@ using namespace std;				// to use stl vectors
 inline float Rand( float range ) { return ((float)rand() / RAND_MAX) * range; }
 inline int IRand( int range ) { return rand() % range; }
 int filesize( FILE* f );
-void delay();
 
 namespace Tmpl8 {
 
 #define PI					3.14159265358979323846264338327950f
 #define INVPI				0.31830988618379067153776752674503f
 
+#ifdef _WIN32
 #define MALLOC64(x)			_aligned_malloc(x,64)
 #define FREE64(x)			_aligned_free(x)
+#else
+inline void* Malloc64( size_t size ) { void* p; return posix_memalign( &p, 64, size ) ? 0 : p; }
+#define MALLOC64(x)			Malloc64(x)
+#define FREE64(x)			free(x)
+#endif
 #define PREFETCH(x)			_mm_prefetch((const char*)(x),_MM_HINT_T0)
 #define PREFETCH_ONCE(x)	_mm_prefetch((const char*)(x),_MM_HINT_NTA)
 #define PREFETCH_WRITE(x)	_m_prefetchw((const char*)(x))
@@ -64,17 +100,25 @@ struct Timer
 	float elapsed() const { return (float)((get() - start) * inv_freq); } 
 	static value_type get() 
 	{ 
+#ifdef _WIN32
 		LARGE_INTEGER c; 
 		QueryPerformanceCounter( &c ); 
 		return c.QuadPart; 
+#else
+		return std::chrono::duration_cast<std::chrono::nanoseconds>( std::chrono::steady_clock::now().time_since_epoch() ).count();
+#endif
 	} 
 	static double to_time(const value_type vt) { return double(vt) * inv_freq; } 
 	void reset() { start = get(); }
 	static void init() 
 	{ 
+#ifdef _WIN32
 		LARGE_INTEGER f; 
 		QueryPerformanceFrequency( &f ); 
 		inv_freq = 1000./double(f.QuadPart); 
+#else
+		inv_freq = 1e-6; // nanoseconds to milliseconds
+#endif
 	} 
 }; 
 
@@ -144,7 +188,11 @@ float3 operator * ( const float3& v, const float& s );
 class float4
 {
 public:
+#ifdef _MSC_VER
 	union { struct { float x, y, z, w; }; struct { float3 xyz; float w2; }; float cell[4]; };
+#else
+	union { struct { float x, y, z, w; }; float cell[4]; }; // standard C++: no members with constructors in a union
+#endif
 	float4() {}
 	float4( float v ) : x( v ), y( v ), z( v ), w( v ) {}
 	float4( float x, float y, float z, float w ) : x( x ), y( y ), z( z ), w( w ) {}
@@ -2,9 +2,13 @@
 // IGAD/NHTV/UU - Jacco Bikker - 2006-2016
 
 #include "template.h"
+#ifndef _WIN32
+#include <pthread.h>
+#endif
 
 using namespace Tmpl8;
 
+#ifdef _WIN32
 const int Thread::P_ABOVE_NORMAL = THREAD_PRIORITY_ABOVE_NORMAL;
 const int Thread::P_BELOW_NORMAL = THREAD_PRIORITY_BELOW_NORMAL;
 const int Thread::P_HIGHEST = THREAD_PRIORITY_HIGHEST;
@@ -12,38 +16,67 @@ const int Thread::P_IDLE = THREAD_PRIORITY_IDLE;
 const int Thread::P_LOWEST = THREAD_PRIORITY_LOWEST;
 const int Thread::P_NORMAL = THREAD_PRIORITY_NORMAL;
 const int Thread::P_CRITICAL = THREAD_PRIORITY_TIME_CRITICAL;
+#else
+// same values as Windows; priorities are not applied elsewhere
+const int Thread::P_ABOVE_NORMAL = 1;
+const int Thread::P_BELOW_NORMAL = -1;
+const int Thread::P_HIGHEST = 2;
+const int Thread::P_IDLE = -15;
+const int Thread::P_LOWEST = -2;
+const int Thread::P_NORMAL = 0;
+const int Thread::P_CRITICAL = 15;
+#endif
 
 unsigned int sthread_proc( void* param ) { Thread* tp = (Thread*)param; tp->run(); return 0; }
 
-void Thread::sleep( long ms ) { Sleep( ms ); }
-void Thread::setPriority( int tp ) { SetThreadPriority( m_hThread, tp ); }
-void Thread::suspend() { SuspendThread( m_hThread ); }
-void Thread::resume() { ResumeThread( m_hThread ); }
+void Thread::sleep( long ms ) { std::this_thread::sleep_for( std::chrono::milliseconds( ms ) ); }
+
+#ifdef _WIN32
+void Thread::setPriority( int tp ) { if (m_Thread) SetThreadPriority( (HANDLE)m_Thread->native_handle(), tp ); }
+void Thread::suspend() { if (m_Thread) SuspendThread( (HANDLE)m_Thread->native_handle() ); }
+void Thread::resume() { if (m_Thread) ResumeThread( (HANDLE)m_Thread->native_handle() ); }
+#else
+void Thread::setPriority( int tp ) {}
+void Thread::suspend() {}
+void Thread::resume() {}
+#endif
 
 void Thread::start() 
 {
-	DWORD tid = 0;	
-	m_hThread = (unsigned long*)CreateThread( NULL, 0, (LPTHREAD_START_ROUTINE)sthread_proc, (Thread*)this, 0, &tid );
+	stop();
+	m_Thread = new std::thread( sthread_proc, (void*)this );
 	setPriority( Thread::P_NORMAL );
 }
 
 void Thread::kill()
 {
-	TerminateThread( m_hThread, 0 );
-	CloseHandle( m_hThread );
-	m_hThread = NULL;
+	// there is no portable way to terminate a thread: let it run to completion on its own
+	if (m_Thread == NULL) return;
+	m_Thread->detach();
+	delete m_Thread;
+	m_Thread = NULL;
 }
 
 void Thread::stop() 
 {
-	if (m_hThread == NULL) return;	
-	WaitForSingleObject( m_hThread, INFINITE );
-	CloseHandle( m_hThread );
-	m_hThread = NULL;
+	if (m_Thread == NULL) return;	
+	if (m_Thread->joinable()) m_Thread->join();
+	delete m_Thread;
+	m_Thread = NULL;
 }
 
 void Thread::SetName( char* _Name )
 {
+	if (m_Thread) SetThreadName( m_Thread, _Name );
+}
+
+// ------------------------------------------------------------------
+// PLACEMENT
+// ------------------------------------------------------------------
+
+void SetThreadName( std::thread* thread, const char* name )
+{
+#ifdef _WIN32
 	typedef struct tagTHREADNAME_INFO
 	{
 		DWORD dwType;		// must be 0x1000
@@ -51,49 +84,323 @@ void Thread::SetName( char* _Name )
 		DWORD dwThreadID;	// thread ID (-1=caller thread)
 		DWORD dwFlags;		// reserved for future use, must be zero
 	} THREADNAME_INFO;
-	DWORD dwThreadID = GetThreadId( m_hThread );
+	DWORD dwThreadID = GetThreadId( (HANDLE)thread->native_handle() );
 	THREADNAME_INFO info;
 	info.dwType = 0x1000;
-	info.szName = _Name;
+	info.szName = name;
 	info.dwThreadID = dwThreadID;
 	info.dwFlags = 0;
 	if (::IsDebuggerPresent()) RaiseException( 0x406D1388, 0, sizeof( info ) / sizeof( ULONG_PTR ), (ULONG_PTR*)&info );
+#else
+	char shortName[16]; // Linux limit, including the terminator
+	strncpy( shortName, name, 15 );
+	shortName[15] = 0;
+	pthread_setname_np( thread->native_handle(), shortName );
+#endif
 }
 
-DWORD JobThreadProc( LPVOID lpParameter )
+bool SetThreadCore( std::thread* thread, int core )
 {
-	JobThread* JobThreadInstance = (JobThread*) lpParameter;
-	JobThreadInstance->BackgroundTask();
-	return 0;
+#ifdef _WIN32
+	if (core >= 64) return false; // first processor group only
+	return SetThreadAffinityMask( (HANDLE)thread->native_handle(), (DWORD_PTR)1 << core ) != 0;
+#else
+	cpu_set_t set;
+	CPU_ZERO( &set );
+	CPU_SET( core, &set );
+	return pthread_setaffinity_np( thread->native_handle(), sizeof( set ), &set ) == 0;
+#endif
 }
 
-void JobThread::CreateAndStartThread( unsigned int threadId )
+bool SetThreadCores( std::thread* thread, const std::vector<int>& cores )
 {
-	m_GoSignal = CreateEvent( 0, FALSE, FALSE, 0 );
-	m_ThreadHandle = CreateThread( 0, 0, (LPTHREAD_START_ROUTINE) &JobThreadProc, (LPVOID) this, 0, 0 );
-	m_ThreadID = threadId;
+#ifdef _WIN32
+	// the node masks of CpuTopology are those of the first processor group
+	GROUP_AFFINITY affinity = {};
+	for (size_t i = 0; i < cores.size(); i++) if (cores[i] < 64) affinity.Mask |= (KAFFINITY)1 << cores[i];
+	if (!affinity.Mask) return false;
+	return SetThreadGroupAffinity( (HANDLE)thread->native_handle(), &affinity, 0 ) != 0;
+#else
+	cpu_set_t set;
+	CPU_ZERO( &set );
+	for (size_t i = 0; i < cores.size(); i++) if (cores[i] < CPU_SETSIZE) CPU_SET( cores[i], &set );
+	if (!CPU_COUNT( &set )) return false;
+	return pthread_setaffinity_np( thread->native_handle(), sizeof( set ), &set ) == 0;
+#endif
 }
-void JobThread::BackgroundTask()
+
+CpuTopology::CpuTopology()
 {
-	while (1)
+	nodes = 0;
+#ifdef _WIN32
+	ULONG highest = 0;
+	if (GetNumaHighestNodeNumber( &highest )) for (ULONG n = 0; n <= highest && nodes < MAXNUMANODES; n++)
+	{
+		ULONGLONG mask = 0;
+		if (!GetNumaNodeProcessorMask( (UCHAR)n, &mask ) || !mask) continue;
+		for (int i = 0; i < 64; i++) if (mask & (1ULL << i)) cpus[nodes].push_back( i );
+		nodes++;
+	}
+#else
+	// /sys/devices/system/node/nodeN/cpulist holds ranges like "0-7,16-23"
+	for (int n = 0; n < 64 && nodes < MAXNUMANODES; n++)
 	{
-		WaitForSingleObject( m_GoSignal, INFINITE );
-		while (1)
+		char path[64], list[1024];
+		sprintf( path, "/sys/devices/system/node/node%i/cpulist", n );
+		FILE* f = fopen( path, "r" );
+		if (!f) continue;
+		if (fgets( list, sizeof( list ), f ))
 		{
-			Job* job = JobManager::GetJobManager()->GetNextJob();
-			if (!job) 
+			for (char* range = strtok( list, ",\n" ); range; range = strtok( 0, ",\n" ))
 			{
-				JobManager::GetJobManager()->ThreadDone( m_ThreadID );
-				break;
+				int first, last;
+				int fields = sscanf( range, "%i-%i", &first, &last );
+				if (fields == 1) last = first;
+				if (fields >= 1) for (int i = first; i <= last; i++) cpus[nodes].push_back( i );
 			}
-			job->RunCodeWrapper();
 		}
+		fclose( f );
+		if (cpus[nodes].size()) nodes++;
+	}
+#endif
+	if (nodes > 0) return;
+	// no NUMA information: one node with every processor
+	nodes = 1;
+	int count = (int)std::thread::hardware_concurrency();
+	for (int i = 0; i < (count > 0 ? count : 1); i++) cpus[0].push_back( i );
+}
+
+// ------------------------------------------------------------------
+// WORK-STEALING DEQUE
+// After Chase & Lev, "Dynamic circular work-stealing deque" (2005),
+// with the C11 memory orderings of Le et al. (2013).
+// ------------------------------------------------------------------
+
+JobDeque::JobDeque() : m_Top( 0 ), m_Bottom( 0 )
+{
+	m_Ring = new Ring( MAXJOBS );
+}
+
+JobDeque::~JobDeque()
+{
+	Reclaim();
+	delete m_Ring.load();
+}
+
+void JobDeque::Push( Job* a_Job )
+{
+	long long b = m_Bottom.load( std::memory_order_relaxed ), t = m_Top.load( std::memory_order_acquire );
+	Ring* ring = m_Ring.load( std::memory_order_relaxed );
+	if (b - t > ring->m_Mask)
+	{
+		// full: copy the live jobs to a ring twice the size
+		Ring* bigger = new Ring( (ring->m_Mask + 1) * 2 );
+		for (long long i = t; i < b; i++)
+			bigger->m_Jobs[i & bigger->m_Mask].store( ring->m_Jobs[i & ring->m_Mask].load( std::memory_order_relaxed ), std::memory_order_relaxed );
+		bigger->m_Retired = ring;
+		m_Ring.store( bigger, std::memory_order_release );
+		ring = bigger;
+	}
+	ring->m_Jobs[b & ring->m_Mask].store( a_Job, std::memory_order_relaxed );
+	m_Bottom.store( b + 1, std::memory_order_release ); // publishes the job to thieves
+}
+
+Job* JobDeque::Pop()
+{
+	long long b = m_Bottom.load( std::memory_order_relaxed ) - 1;
+	Ring* ring = m_Ring.load( std::memory_order_relaxed );
+	m_Bottom.store( b, std::memory_order_relaxed );
+	std::atomic_thread_fence( std::memory_order_seq_cst );
+	long long t = m_Top.load( std::memory_order_relaxed );
+	if (t > b)
+	{
+		// empty
+		m_Bottom.store( b + 1, std::memory_order_relaxed );
+		return 0;
+	}
+	Job* job = ring->m_Jobs[b & ring->m_Mask].load( std::memory_order_relaxed );
+	if (t == b)
+	{
+		// last job: race the thieves for it
+		if (!m_Top.compare_exchange_strong( t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed )) job = 0;
+		m_Bottom.store( b + 1, std::memory_order_relaxed );
+	}
+	return job;
+}
+
+Job* JobDeque::Steal()
+{
+	long long t = m_Top.load( std::memory_order_acquire );
+	std::atomic_thread_fence( std::memory_order_seq_cst );
+	long long b = m_Bottom.load( std::memory_order_acquire );
+	if (t >= b) return 0;
+	Ring* ring = m_Ring.load( std::memory_order_acquire );
+	Job* job = ring->m_Jobs[t & ring->m_Mask].load( std::memory_order_relaxed );
+	// lost against the owner or another thief: let the caller look elsewhere
+	if (!m_Top.compare_exchange_strong( t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed )) return 0;
+	return job;
+}
+
+void JobDeque::Reclaim()
+{
+	Ring* ring = m_Ring.load();
+	while (Ring* old = ring->m_Retired) ring->m_Retired = old->m_Retired, delete old;
+}
+
+// ------------------------------------------------------------------
+// SUBMISSION QUEUE
+// ------------------------------------------------------------------
+
+JobQueue::JobQueue()
+{
+	m_First = new Segment();
+	m_Head = m_Tail = m_First;
+}
+
+JobQueue::~JobQueue()
+{
+	while (m_First) { Segment* next = m_First->m_Next; delete m_First; m_First = next; }
+}
+
+void JobQueue::Push( Job* a_Job )
+{
+	while (1)
+	{
+		Segment* segment = m_Tail.load();
+		int i = segment->m_Tail.fetch_add( 1 );
+		if (i < JOBSEGMENT)
+		{
+			segment->m_Jobs[i].store( a_Job, std::memory_order_release );
+			return;
+		}
+		// segment full: append a new one (or use the one another producer appended) and retry there
+		Segment* next = segment->m_Next.load();
+		if (!next)
+		{
+			Segment* fresh = new Segment();
+			if (segment->m_Next.compare_exchange_strong( next, fresh )) next = fresh; else delete fresh;
+		}
+		m_Tail.compare_exchange_strong( segment, next );
+	}
+}
+
+Job* JobQueue::Pop()
+{
+	while (1)
+	{
+		Segment* segment = m_Head.load();
+		int h = segment->m_Head.load(), t = segment->m_Tail.load();
+		if (h < JOBSEGMENT)
+		{
+			if (h >= t) return 0; // empty
+			if (!segment->m_Head.compare_exchange_weak( h, h + 1 )) continue;
+			// the slot is claimed, but its producer may still be storing the job
+			Job* job;
+			while (!(job = segment->m_Jobs[h].load( std::memory_order_acquire ))) std::this_thread::yield();
+			return job;
+		}
+		// segment drained: move on, if a producer appended another
+		Segment* next = segment->m_Next.load();
+		if (!next) return 0;
+		m_Head.compare_exchange_strong( segment, next );
 	}
 }
 
-void JobThread::Go()
+void JobQueue::Reclaim()
+{
+	Segment* head = m_Head.load();
+	while (m_First != head) { Segment* next = m_First->m_Next; delete m_First; m_First = next; }
+}
+
+// ------------------------------------------------------------------
+// JOB SYSTEM
+// ------------------------------------------------------------------
+
+static THREADLOCAL int workerIndex = -1;	// index of the calling job thread; -1 elsewhere
+
+#define JOBSPINPAUSE	64		// polls with _mm_pause before an idle thread starts yielding
+
+static void Clamp( int& budget ) { budget = budget < JOBSPINMIN ? JOBSPINMIN : budget > JOBSPINMAX ? JOBSPINMAX : budget; }
+
+// wait until done() holds: poll (pause, then yield) for up to budget polls, or for as
+// long as it takes in hot mode, then block(). The budget follows the waits: it moves
+// towards twice the length of waits that ended while polling, doubles when a blocked
+// wait ended soon after polling gave up and halves when it did not. Returns false if
+// the caller had to block.
+template <class F, class B> static bool SpinThenBlock( F done, B block, int& budget, const std::atomic<bool>& hot )
 {
-	SetEvent( m_GoSignal );
+	Timer::value_type start = Timer::get();
+	for (int i = 0; i < budget || hot.load( std::memory_order_relaxed ); i += i < budget)
+	{
+		if (done())
+		{
+			budget += (2 * i - budget) / 4;
+			Clamp( budget );
+			return true;
+		}
+		if (i < JOBSPINPAUSE) _mm_pause(); else std::this_thread::yield();
+	}
+	Timer::value_type spun = Timer::get() - start;
+	block();
+	budget = Timer::get() - start < 2 * spun ? budget * 2 : budget / 2;
+	Clamp( budget );
+	return false;
+}
+
+static void AtomicMax( std::atomic<long long>& a_Max, long long a_Value )
+{
+	long long current = a_Max.load();
+	while (a_Value > current && !a_Max.compare_exchange_weak( current, a_Value ));
+}
+
+void JobThread::CreateAndStartThread( unsigned int threadId )
+{
+	m_ThreadID = threadId;
+	m_Thread = new std::thread( &JobThread::BackgroundTask, this );
+	char name[32];
+	sprintf( name, "job worker %i", threadId );
+	SetThreadName( m_Thread, name );
+	if (m_Core >= 0 && !SetThreadCore( m_Thread, m_Core )) m_Core = -1;
+}
+
+void JobThread::WaitForThreadToStop()
+{
+	if (!m_Thread) return;
+	m_Thread->join();
+	delete m_Thread;
+	m_Thread = 0;
+}
+
+void JobThread::BackgroundTask()
+{
+	JobManager* manager = JobManager::GetJobManager();
+	workerIndex = m_ThreadID;
+	unsigned int generation = 0;
+	while (1)
+	{
+		// wait for RunJobs: spin, then sleep (never, in hot mode)
+		bool spun = SpinThenBlock( [&]() { return manager->m_Generation.load() != generation || manager->m_Quit.load(); }, [&]()
+		{
+			std::unique_lock<std::mutex> lock( manager->m_Lock );
+			manager->m_Sleeping++;
+			while (manager->m_Generation.load() == generation && !manager->m_Quit) manager->m_Go.wait( lock );
+			manager->m_Sleeping--;
+		}, m_Spin, manager->m_Hot );
+		if (manager->m_Quit) return;
+		generation = manager->m_Generation;
+		long long wake = Timer::get() - manager->m_DispatchTick.load();
+		manager->m_WakeTicks += wake;
+		AtomicMax( manager->m_WakeMax, wake );
+		if (spun) manager->m_SpinWakes++; else manager->m_BlockWakes++;
+		// work until every job of this round is done, including jobs still running elsewhere,
+		// which may add more
+		while (manager->m_Pending.load() > 0)
+		{
+			Job* job = manager->GetNextJob( m_ThreadID );
+			if (job) manager->Execute( job ); else std::this_thread::yield();
+		}
+		manager->ThreadDone( m_ThreadID );
+	}
 }
 
 void Job::RunCodeWrapper()
@@ -104,52 +411,186 @@ JobManager* JobManager::m_JobManager = 0;
 
 JobManager::JobManager( unsigned int threads ) : m_NumThreads( threads )
 {
-	InitializeCriticalSection( &m_CS );
+	m_Generation = m_Active = 0;
+	m_Sleeping = 0;
+	m_Waiting = m_Quit = m_Hot = false;
+	m_Spin = JOBSPINMIN;
+	m_DispatchTick = m_DoneTick = 0;
+	ResetStats();
+	m_Pending = m_Submitting = 0;
+	m_NextNode = 0;
+	m_Nodes = 1;
+	m_JobThreadList = 0;
 }
 
 JobManager::~JobManager()
 {
-	DeleteCriticalSection( &m_CS );
+	m_Quit = true;
+	{ std::lock_guard<std::mutex> lock( m_Lock ); }
+	m_Go.notify_all();
+	for (unsigned int i = 0; i < m_NumThreads; i++) m_JobThreadList[i].WaitForThreadToStop();
+	delete[] m_JobThreadList;
 }
 
-void JobManager::CreateJobManager( unsigned int numThreads )
+void JobManager::CreateJobManager( unsigned int numThreads, int flags )
 {
+	if (numThreads > MAXJOBTHREADS) numThreads = MAXJOBTHREADS;
+	if (numThreads < 1) numThreads = 1;
+	Timer::init();
 	m_JobManager = new JobManager( numThreads );
 	m_JobManager->m_JobThreadList = new JobThread[numThreads];
+	// placement: with JOBS_NUMA, worker i goes to node i % nodes and may only run on
+	// that node's processors; pinned workers take them (or those of the machine) in order
+	CpuTopology topology;
+	bool numa = (flags & JOBS_NUMA) != 0;
+	if (numa) m_JobManager->m_Nodes = topology.nodes;
+	std::vector<int> all;
+	for (int n = 0; n < topology.nodes; n++) all.insert( all.end(), topology.cpus[n].begin(), topology.cpus[n].end() );
 	for ( unsigned int i = 0 ; i < numThreads; i++ ) 
 	{
-		m_JobManager->m_JobThreadList[i].CreateAndStartThread( i );
-		m_JobManager->m_ThreadDone[i] = CreateEvent( 0, FALSE, FALSE, 0 );
+		JobThread& worker = m_JobManager->m_JobThreadList[i];
+		worker.m_Node = numa ? i % topology.nodes : 0;
+		const std::vector<int>& cpus = numa ? topology.cpus[worker.m_Node] : all;
+		if (flags & JOBS_PIN) worker.m_Core = cpus[(numa ? i / topology.nodes : i) % cpus.size()];
+		worker.CreateAndStartThread( i );
+		// unpinned (or pinning failed): still keep the worker, and the memory it first touches, on its node
+		if (numa && topology.nodes > 1 && worker.m_Core < 0) SetThreadCores( worker.m_Thread, cpus );
 	}
-	m_JobManager->m_JobCount = 0;
 }
 
 void JobManager::AddJob2( Job* a_Job )
 {
-	m_JobList[m_JobCount++] = a_Job;
+	m_Pending++;
+	// jobs with unfinished predecessors are queued by the last one to finish
+	if (--a_Job->m_Dependencies == 0) Schedule( a_Job );
 }
 
-Job* JobManager::GetNextJob()
+void JobManager::Schedule( Job* a_Job )
 {
-	Job* job = 0;
-	EnterCriticalSection( &m_CS );
-	if (m_JobCount > 0) job = m_JobList[--m_JobCount];
-	LeaveCriticalSection( &m_CS );
-	return job;
+	// from a job thread: onto its own deque, unless the job wants another node;
+	// from anywhere else: the queue of the job's node, or the next one in turn
+	int node = a_Job->m_Node >= 0 ? a_Job->m_Node % m_Nodes : -1;
+	if (workerIndex >= 0 && (node < 0 || node == m_JobThreadList[workerIndex].m_Node)) m_JobThreadList[workerIndex].m_Jobs.Push( a_Job ); else
+	{
+		if (node < 0) node = m_NextNode++ % m_Nodes;
+		m_Submitting++;
+		m_Queue[node].Push( a_Job );
+		m_Submitting--;
+	}
+}
+
+void JobManager::Execute( Job* a_Job )
+{
+	// re-arm, so the job can be added again
+	a_Job->m_Dependencies = a_Job->m_Predecessors + 1;
+	a_Job->RunCodeWrapper();
+	std::atomic<int>* counter = a_Job->m_Counter;
+	// release the continuations; once one is scheduled, it may free this job, so collect them first
+	std::vector<Job*> ready;
+	for (size_t i = 0; i < a_Job->m_Continuations.size(); i++)
+		if (--a_Job->m_Continuations[i]->m_Dependencies == 0) ready.push_back( a_Job->m_Continuations[i] );
+	for (size_t i = 0; i < ready.size(); i++) Schedule( ready[i] );
+	if (counter) (*counter)--;
+	m_Pending--;
+}
+
+void JobManager::Wait( std::atomic<int>& a_Counter )
+{
+	if (workerIndex < 0) { RunJobs(); return; }
+	// help out instead of blocking a worker
+	while (a_Counter.load() > 0)
+	{
+		Job* job = GetNextJob( workerIndex );
+		if (job) Execute( job ); else std::this_thread::yield();
+	}
+}
+
+Job* JobManager::GetNextJob( unsigned int thread )
+{
+	Job* job = m_JobThreadList[thread].m_Jobs.Pop();
+	if (job) return job;
+	int node = m_JobThreadList[thread].m_Node;
+	for (int i = 0; i < m_Nodes; i++) if ((job = m_Queue[(node + i) % m_Nodes].Pop())) return job;
+	// steal, starting at the next worker so thieves spread out; same node first
+	for (int pass = 0; pass < (m_Nodes > 1 ? 2 : 1); pass++)
+		for (unsigned int i = 1; i < m_NumThreads; i++)
+		{
+			JobThread& victim = m_JobThreadList[(thread + i) % m_NumThreads];
+			if (m_Nodes > 1 && (victim.m_Node == node) != (pass == 0)) continue;
+			if ((job = victim.m_Jobs.Steal())) return job;
+		}
+	return 0;
 }
 
 void JobManager::RunJobs()
 {
-	for ( unsigned int i = 0; i < m_NumThreads; i++ ) 
+	if (m_Pending.load() == 0) return;
+	m_Active = m_NumThreads;
+	m_DoneTick = 0;
+	m_DispatchTick = Timer::get();
+	m_Generation++;
+	// spinning workers see the new generation by themselves; sleeping ones need a notify.
+	// A worker about to sleep increments m_Sleeping before it checks m_Generation, so
+	// either it sees the new round or we see it sleeping.
+	if (m_Sleeping.load() > 0)
 	{
-		m_JobThreadList[i].Go();
+		{ std::lock_guard<std::mutex> lock( m_Lock ); }
+		m_Go.notify_all();
 	}
-	WaitForMultipleObjects( m_NumThreads, m_ThreadDone, TRUE, INFINITE );
+	// every worker reports in once the round is done
+	SpinThenBlock( [&]() { return m_Active.load() == 0; }, [&]()
+	{
+		std::unique_lock<std::mutex> lock( m_Lock );
+		m_Waiting = true;
+		while (m_Active.load() > 0) m_Done.wait( lock );
+		m_Waiting = false;
+	}, m_Spin, m_Hot );
+	long long back = Timer::get() - m_DoneTick.load();
+	m_ReturnTicks += back;
+	if (back > m_ReturnMax) m_ReturnMax = back;
+	m_Dispatches++;
+	// nobody steals or pops now; the queue's segments are only safe to free if nobody is pushing either
+	for (unsigned int i = 0; i < m_NumThreads; i++) m_JobThreadList[i].m_Jobs.Reclaim();
+	if (m_Submitting.load() == 0) for (int i = 0; i < m_Nodes; i++) m_Queue[i].Reclaim();
 }
 
 void JobManager::ThreadDone( unsigned int n ) 
 { 
-	SetEvent( m_ThreadDone[n] ); 
+	// the latest finish, for the return latency; recorded before m_Active drops, so RunJobs sees it
+	AtomicMax( m_DoneTick, Timer::get() );
+	// same handshake as m_Sleeping: RunJobs sets m_Waiting before it checks m_Active
+	if (--m_Active > 0 || !m_Waiting.load()) return;
+	{ std::lock_guard<std::mutex> lock( m_Lock ); }
+	m_Done.notify_all();
+}
+
+DispatchStats JobManager::GetStats()
+{
+	DispatchStats stats;
+	stats.dispatches = m_Dispatches;
+	stats.spinWakes = m_SpinWakes, stats.blockWakes = m_BlockWakes;
+	unsigned long long wakes = stats.spinWakes + stats.blockWakes;
+	stats.wakeAverage = wakes ? Timer::to_time( m_WakeTicks ) / wakes : 0;
+	stats.wakeMax = Timer::to_time( m_WakeMax );
+	stats.returnAverage = m_Dispatches ? Timer::to_time( m_ReturnTicks ) / m_Dispatches : 0;
+	stats.returnMax = Timer::to_time( m_ReturnMax );
+	return stats;
+}
+
+void JobManager::ResetStats()
+{
+	m_WakeTicks = m_WakeMax = 0;
+	m_SpinWakes = m_BlockWakes = 0;
+	m_ReturnTicks = m_ReturnMax = 0;
+	m_Dispatches = 0;
+}
+
+void JobManager::PrintStats()
+{
+	DispatchStats stats = GetStats();
+	printf( "dispatch: %llu rounds; worker wakeup %.1f us avg, %.1f us max (%llu spinning, %llu blocked); return %.1f us avg, %.1f us max\n",
+		stats.dispatches, stats.wakeAverage * 1000, stats.wakeMax * 1000, stats.spinWakes, stats.blockWakes,
+		stats.returnAverage * 1000, stats.returnMax * 1000 );
 }
 
-// EOF
\ No newline at end of file
+// EOF
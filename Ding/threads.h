@@ -4,24 +4,40 @@
 #pragma once
 
 #define MAXJOBTHREADS	32
-#define MAXJOBS			512
+#define MAXJOBS			512		// initial capacity of a worker's job deque (grows on demand)
+#define JOBSEGMENT		256		// jobs per segment of the shared submission queue
+#define MAXNUMANODES	8
+#define JOBSPINMIN		256		// adaptive spin budget of an idle thread before it blocks, in polls
+#define JOBSPINMAX		65536
+
+// JobManager::CreateJobManager flags
+#define JOBS_PIN		1		// pin every worker to its own core
+#define JOBS_NUMA		2		// group workers by NUMA node: a queue per node, steal within the node first
+
+// thread-local storage (VS2013 has no thread_local)
+#ifdef _MSC_VER
+#define THREADLOCAL		__declspec(thread)
+#else
+#define THREADLOCAL		__thread
+#endif
 
 class Thread 
 {
 public:
-	Thread() { m_hThread = 0; }
-	unsigned long* handle() { return m_hThread; }
+	Thread() { m_Thread = 0; }
+	virtual ~Thread() { stop(); }
+	std::thread* handle() { return m_Thread; }
 	void start();
 	virtual void run() {};
 	void sleep(long ms);
-	void suspend();
-	void resume();
+	void suspend();				// Windows only
+	void resume();				// Windows only
 	void kill();
 	void stop();
-	void setPriority( int p );
+	void setPriority( int p );	// Windows only
 	void SetName( char* _Name );
 private:
-	unsigned long* m_hThread;
+	std::thread* m_Thread;
 	static const int P_ABOVE_NORMAL;
 	static const int P_BELOW_NORMAL;
 	static const int P_HIGHEST;
@@ -32,26 +48,121 @@ private:
 };
 extern "C" { unsigned int sthread_proc( void* param ); }
 
+// name a thread for debuggers and profilers (Linux: at most 15 characters are kept)
+void SetThreadName( std::thread* thread, const char* name );
+// restrict a thread to one logical processor; false if that is not possible
+bool SetThreadCore( std::thread* thread, int core );
+// restrict a thread to a set of logical processors (a NUMA node); false if that is not possible
+bool SetThreadCores( std::thread* thread, const std::vector<int>& cores );
+
+// logical processors per NUMA node; a single node when the machine
+// has no NUMA or the layout cannot be read
+struct CpuTopology
+{
+	CpuTopology();
+	int nodes;
+	std::vector<int> cpus[MAXNUMANODES];
+};
+
 namespace Tmpl8 {
 
 class Job
 {
 public:
+	Job() : m_Dependencies( 1 ), m_Predecessors( 0 ), m_Counter( 0 ), m_Node( -1 ) {}
+	virtual ~Job() {}
 	virtual void Main() = 0;
+	// run this job only after a_Job has finished. Set up the graph before adding its jobs;
+	// it is kept, so the same jobs can be added again for the next RunJobs.
+	void DependsOn( Job* a_Job ) { m_Dependencies++, m_Predecessors++; a_Job->m_Continuations.push_back( this ); }
+	// decremented once the job and its bookkeeping are done; see JobManager::Wait
+	void SetCounter( std::atomic<int>* a_Counter ) { m_Counter = a_Counter; }
+	// with JOBS_NUMA: queue the job on this node (jobs allocate their data where they run); -1: any
+	void SetNode( int a_Node ) { m_Node = a_Node; }
 protected:
 	friend class JobThread;
+	friend class JobManager;
 	void RunCodeWrapper();
+	std::atomic<int> m_Dependencies;		// unfinished predecessors, plus one until the job is added
+	int m_Predecessors;
+	std::vector<Job*> m_Continuations;		// jobs that depend on this one
+	std::atomic<int>* m_Counter;
+	int m_Node;
+};
+
+// Chase-Lev work-stealing deque: the owning worker pushes and pops at
+// the bottom (LIFO, so it keeps working on warm data), other workers
+// steal from the top (oldest, usually largest, jobs first). A full ring
+// is replaced by one twice the size; thieves may still be reading the
+// old one, so outgrown rings are kept until Reclaim.
+class JobDeque
+{
+public:
+	JobDeque();
+	~JobDeque();
+	void Push( Job* a_Job );	// owner only
+	Job* Pop();					// owner only
+	Job* Steal();				// any thread
+	void Reclaim();				// free outgrown rings; only while nobody steals
+private:
+	struct Ring
+	{
+		Ring( long long size ) : m_Mask( size - 1 ), m_Retired( 0 ) { m_Jobs = new std::atomic<Job*>[(size_t)size]; }
+		~Ring() { delete[] m_Jobs; }
+		long long m_Mask;
+		std::atomic<Job*>* m_Jobs;
+		Ring* m_Retired;		// next older ring, still readable by late thieves
+	};
+	std::atomic<long long> m_Top, m_Bottom;
+	std::atomic<Ring*> m_Ring;
+};
+
+// lock-free, unbounded multi-producer / multi-consumer queue, for jobs
+// submitted from outside the job threads: a linked list of segments of
+// JOBSEGMENT slots. A producer claims a slot with a single atomic add
+// and appends a new segment when the last one is full; consumers claim
+// slots with a compare-and-swap. Drained segments are freed by Reclaim.
+class JobQueue
+{
+public:
+	JobQueue();
+	~JobQueue();
+	void Push( Job* a_Job );	// any thread
+	Job* Pop();					// any thread; 0 when empty
+	void Reclaim();				// free drained segments; only while nobody pushes or pops
+private:
+	struct Segment
+	{
+		Segment() : m_Head( 0 ), m_Tail( 0 ), m_Next( 0 ) { for (int i = 0; i < JOBSEGMENT; i++) m_Jobs[i] = 0; }
+		std::atomic<int> m_Head, m_Tail;	// next slot to pop / to claim (m_Tail may pass JOBSEGMENT)
+		std::atomic<Segment*> m_Next;
+		std::atomic<Job*> m_Jobs[JOBSEGMENT];
+	};
+	std::atomic<Segment*> m_Head, m_Tail;
+	Segment* m_First;				// oldest segment not yet freed
+};
+
+// dispatch latency, over all RunJobs calls since the last ResetStats
+struct DispatchStats
+{
+	unsigned long long dispatches;			// RunJobs calls that had jobs to run
+	unsigned long long spinWakes, blockWakes;	// worker wakeups while spinning / from the condition variable
+	double wakeAverage, wakeMax;			// ms from RunJobs to a worker starting on the round
+	double returnAverage, returnMax;		// ms from the last worker finishing to RunJobs returning
 };
 
 class JobThread
 {
 public:
+	JobThread() : m_Thread( 0 ), m_Node( 0 ), m_Core( -1 ), m_Spin( JOBSPINMIN ) {}
 	void CreateAndStartThread( unsigned int threadId );
 	void WaitForThreadToStop();
-	void Go();
 	void BackgroundTask();
-	HANDLE m_GoSignal, m_ThreadHandle;
+	std::thread* m_Thread;
+	JobDeque m_Jobs;
 	int m_ThreadID;
+	int m_Node, m_Core;			// NUMA node (0 without JOBS_NUMA); pinned core, or -1
+	int m_Spin;					// current spin budget between rounds
 };
 
 class JobManager	// singleton class!
@@ -60,23 +171,85 @@ protected:
 	JobManager( unsigned int numThreads );
 public:
 	~JobManager();
-	static void CreateJobManager( unsigned int numThreads );
+	static void CreateJobManager( unsigned int numThreads, int flags = 0 );
 	static JobManager* GetJobManager() { return m_JobManager; }
+	// add a job, from any thread; jobs added by running jobs run in the same RunJobs,
+	// other jobs in the current RunJobs if it is still busy, or else in the next
 	void AddJob2( Job* a_Job );
 	unsigned int GetNumThreads() { return m_NumThreads; }
+	int GetNumNodes() { return m_Nodes; }
 	void RunJobs();
+	// wait until a_Counter drops to zero: a job thread runs other jobs meanwhile;
+	// any other thread calls RunJobs (so it must be the only one that does)
+	void Wait( std::atomic<int>& a_Counter );
 	void ThreadDone( unsigned int n );
 	int MaxConcurrent() { return m_NumThreads; }
+	// hot mode: idle workers keep spinning between RunJobs calls instead of blocking,
+	// for back-to-back dispatches (every frame, every chunk); costs a core per worker
+	void SetHot( bool a_Hot ) { m_Hot = a_Hot; }
+	DispatchStats GetStats();
+	void ResetStats();
+	void PrintStats();
 protected:
 	friend class JobThread;
-	Job* GetNextJob();
-	Job* FindNextJob();
+	Job* GetNextJob( unsigned int thread );		// own deque, own node's queue, other queues, then steal (own node first)
+	void Schedule( Job* a_Job );				// queue a job whose predecessors are done
+	void Execute( Job* a_Job );					// run a job, then release its continuations
 	static JobManager* m_JobManager;
-	Job* m_JobList[MAXJOBS];
-	CRITICAL_SECTION m_CS;
-	HANDLE m_ThreadDone[MAXJOBTHREADS];
-	unsigned int m_NumThreads, m_JobCount;
+	// idle threads spin for a while, then block on m_Go / m_Done; the lock
+	// and notify are only needed when somebody is asleep
+	std::mutex m_Lock;							// guards the sleeping side of the go / done handshake
+	std::condition_variable m_Go, m_Done;
+	std::atomic<unsigned int> m_Generation;		// RunJobs calls so far; workers wait for it to change
+	std::atomic<unsigned int> m_Active;			// workers still busy in the current RunJobs
+	std::atomic<int> m_Sleeping;				// workers blocked on m_Go
+	std::atomic<bool> m_Waiting;				// RunJobs blocked on m_Done
+	std::atomic<bool> m_Quit, m_Hot;
+	int m_Spin;									// RunJobs' own spin budget
+	// stats, in Timer ticks
+	std::atomic<long long> m_DispatchTick, m_DoneTick;	// last RunJobs start, last worker finishing
+	std::atomic<long long> m_WakeTicks, m_WakeMax;
+	std::atomic<unsigned long long> m_SpinWakes, m_BlockWakes;
+	long long m_ReturnTicks, m_ReturnMax;
+	unsigned long long m_Dispatches;
+	std::atomic<int> m_Pending;					// jobs added but not yet finished
+	std::atomic<int> m_Submitting;				// threads inside a m_Queue[].Push
+	JobQueue m_Queue[MAXNUMANODES];				// jobs from outside the job threads, per node
+	std::atomic<unsigned int> m_NextNode;		// round robin over the queues for jobs without a node
+	int m_Nodes;
+	unsigned int m_NumThreads;
 	JobThread* m_JobThreadList;
 };
 
-}; // namespace Tmpl8
\ No newline at end of file
+// parallel_for: call fn( i ) for every i in [begin, end), in chunks of grain
+// indices, one job per chunk; returns when all are done. May be called from
+// inside a job: the calling worker helps with the chunks.
+template <class F> class ParallelForJob : public Job
+{
+public:
+	void Main() { for (int i = m_Begin; i < m_End; i++) (*m_Fn)( i ); }
+	int m_Begin, m_End;
+	F* m_Fn;
+};
+
+template <class F> void parallel_for( int begin, int end, int grain, F fn )
+{
+	if (end <= begin) return;
+	if (grain < 1) grain = 1;
+	int chunks = (end - begin + grain - 1) / grain;
+	ParallelForJob<F>* jobs = new ParallelForJob<F>[chunks];
+	std::atomic<int> remaining( chunks );
+	JobManager* manager = JobManager::GetJobManager();
+	for (int i = 0; i < chunks; i++)
+	{
+		jobs[i].m_Begin = begin + i * grain;
+		jobs[i].m_End = jobs[i].m_Begin + grain < end ? jobs[i].m_Begin + grain : end;
+		jobs[i].m_Fn = &fn;
+		jobs[i].SetCounter( &remaining );
+		manager->AddJob2( &jobs[i] );
+	}
+	manager->Wait( remaining );
+	delete[] jobs;
+}
+
+}; // namespace Tmpl8
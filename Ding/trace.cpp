@@ -0,0 +1,323 @@
+#include "template.h"
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// ------------------------------------------------------------------
+// RECORD ENCODING
+// ------------------------------------------------------------------
+
+static byte* PutVarint( byte* p, uint v )
+{
+	while (v >= 0x80) *p++ = (byte)(v | 0x80), v >>= 7;
+	*p++ = (byte)v;
+	return p;
+}
+
+static const byte* GetVarint( const byte* p, const byte* end, uint& v )
+{
+	v = 0;
+	for (int shift = 0; p < end && shift < 35; shift += 7)
+	{
+		v |= (uint)(*p & 0x7F) << shift;
+		if (!(*p++ & 0x80)) return p;
+	}
+	return 0; // truncated or malformed
+}
+
+TraceWriter::TraceWriter()
+{
+	file = 0;
+	packed = new byte[TraceCompressBound( TRACEBLOCK )];
+	records = rawBytes = packedBytes = 0;
+	rawSize = blockRecords = 0;
+	lastAddress = 0, lastSite = 0, lastCore = 0;
+}
+
+TraceWriter::~TraceWriter()
+{
+	Close();
+	delete[] packed;
+}
+
+bool TraceWriter::Open( const char* fileName )
+{
+	Close();
+	file = fopen( fileName, "wb" );
+	if (!file) return false;
+	uint header[2] = { TRACEMAGIC, TRACEVERSION };
+	fwrite( header, sizeof( header ), 1, file );
+	records = rawBytes = 0, packedBytes = sizeof( header );
+	return true;
+}
+
+void TraceWriter::Record( address a, int size, bool write, int site, int core )
+{
+	if (rawSize + TRACERECORDMAX > TRACEBLOCK) Flush();
+	byte* p = raw + rawSize;
+	// flags: bits 0-1 size code (1, 2, 4 bytes), bit 2 write, bit 3 site follows, bit 4 core follows
+	int delta = (int)(a - lastAddress);
+	*p++ = (byte)((size == 4 ? 2 : size == 2 ? 1 : 0) | (write ? 4 : 0) | (site != lastSite ? 8 : 0) | (core != lastCore ? 16 : 0));
+	p = PutVarint( p, ((uint)delta << 1) ^ (uint)(delta >> 31) ); // zigzag: small negative deltas stay small
+	if (site != lastSite) p = PutVarint( p, site );
+	if (core != lastCore) p = PutVarint( p, core );
+	rawSize = (int)(p - raw);
+	lastAddress = a, lastSite = site, lastCore = core;
+	blockRecords++, records++;
+}
+
+void TraceWriter::Flush()
+{
+	if (!rawSize) return;
+	int packedSize = TraceCompress( raw, rawSize, packed );
+	const byte* out = packed;
+	if (packedSize >= rawSize) packedSize = rawSize, out = raw; // incompressible: store
+	uint header[3] = { (uint)rawSize, (uint)packedSize, (uint)blockRecords };
+	if (file)
+	{
+		fwrite( header, sizeof( header ), 1, file );
+		fwrite( out, packedSize, 1, file );
+	}
+	rawBytes += rawSize, packedBytes += packedSize + sizeof( header );
+	rawSize = blockRecords = 0;
+	lastAddress = 0, lastSite = 0, lastCore = 0;
+}
+
+void TraceWriter::Close()
+{
+	if (!file) return;
+	Flush();
+	fclose( file );
+	file = 0;
+}
+
+// ------------------------------------------------------------------
+// STREAMING REPLAY
+// ------------------------------------------------------------------
+
+TraceReader::TraceReader()
+{
+#ifdef _WIN32
+	file = INVALID_HANDLE_VALUE, mapping = 0;
+	SYSTEM_INFO info;
+	GetSystemInfo( &info );
+	granularity = info.dwAllocationGranularity;
+#else
+	file = -1;
+	granularity = (uint)sysconf( _SC_PAGESIZE );
+#endif
+	view = 0, viewStart = 0, viewSize = 0;
+	fileSize = offset = 0;
+	raw = new byte[TRACEBLOCK];
+}
+
+TraceReader::~TraceReader()
+{
+	Close();
+	delete[] raw;
+}
+
+bool TraceReader::Open( const char* fileName )
+{
+	Close();
+#ifdef _WIN32
+	file = CreateFileA( fileName, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, 0 );
+	if (file == INVALID_HANDLE_VALUE) return false;
+	LARGE_INTEGER size;
+	GetFileSizeEx( file, &size );
+	fileSize = size.QuadPart;
+	if (fileSize > 0) mapping = CreateFileMapping( file, 0, PAGE_READONLY, 0, 0, 0 );
+	if (!mapping) { Close(); return false; }
+#else
+	file = open( fileName, O_RDONLY );
+	if (file < 0) return false;
+	struct stat info;
+	fstat( file, &info );
+	fileSize = info.st_size;
+#endif
+	const uint* header = (const uint*)Map( 0, 8 );
+	if (!header || header[0] != TRACEMAGIC || header[1] != TRACEVERSION)
+	{
+		printf( "%s is not a trace file\n", fileName );
+		Close();
+		return false;
+	}
+	offset = 8;
+	return true;
+}
+
+const byte* TraceReader::Map( unsigned long long pos, uint size )
+{
+	if (pos + size > fileSize) return 0;
+	if (view && pos >= viewStart && pos + size <= viewStart + viewSize) return view + (pos - viewStart);
+	// slide the window: map TRACEWINDOW bytes from the granularity boundary below pos
+	Unmap();
+	viewStart = pos & ~(unsigned long long)(granularity - 1);
+	unsigned long long left = fileSize - viewStart;
+	viewSize = left < TRACEWINDOW ? (uint)left : TRACEWINDOW;
+#ifdef _WIN32
+	view = (const byte*)MapViewOfFile( mapping, FILE_MAP_READ, (DWORD)(viewStart >> 32), (DWORD)viewStart, viewSize );
+#else
+	void* p = mmap( 0, viewSize, PROT_READ, MAP_PRIVATE, file, (off_t)viewStart );
+	view = p == MAP_FAILED ? 0 : (const byte*)p;
+	if (view) madvise( p, viewSize, MADV_SEQUENTIAL );
+#endif
+	if (!view) return 0;
+	return view + (pos - viewStart);
+}
+
+void TraceReader::Unmap()
+{
+	if (!view) return;
+#ifdef _WIN32
+	UnmapViewOfFile( view );
+#else
+	munmap( (void*)view, viewSize );
+#endif
+	view = 0;
+}
+
+int TraceReader::Read( TraceRecord* out, int maxRecords )
+{
+	int count = 0;
+	while (offset < fileSize && maxRecords - count >= TRACEBLOCKRECORDS)
+	{
+		const byte* p = Map( offset, 12 );
+		if (!p) return -1;
+		uint header[3];
+		memcpy( header, p, 12 ); // blocks are not aligned
+		uint rawSize = header[0], packedSize = header[1], records = header[2];
+		if (rawSize > TRACEBLOCK || packedSize > rawSize || records > TRACEBLOCKRECORDS) return -1;
+		const byte* packed = Map( offset + 12, packedSize );
+		if (!packed) return -1;
+		const byte* block = packed;
+		if (packedSize < rawSize)
+		{
+			if (TraceDecompress( packed, packedSize, raw, TRACEBLOCK ) != (int)rawSize) return -1;
+			block = raw;
+		}
+		if (DecodeTraceBlock( block, rawSize, out + count, records ) != (int)records) return -1;
+		count += records;
+		offset += 12 + packedSize;
+	}
+	return count;
+}
+
+void TraceReader::Close()
+{
+	Unmap();
+#ifdef _WIN32
+	if (mapping) CloseHandle( mapping );
+	if (file != INVALID_HANDLE_VALUE) CloseHandle( file );
+	file = INVALID_HANDLE_VALUE, mapping = 0;
+#else
+	if (file >= 0) close( file );
+	file = -1;
+#endif
+	fileSize = offset = 0;
+}
+
+int DecodeTraceBlock( const byte* raw, int rawSize, TraceRecord* out, int maxRecords )
+{
+	static const byte sizes[4] = { 1, 2, 4, 0 };
+	const byte* p = raw, *end = raw + rawSize;
+	address a = 0;
+	uint site = 0, core = 0;
+	int n = 0;
+	while (p < end && n < maxRecords)
+	{
+		byte flags = *p++;
+		uint zz;
+		if (!(p = GetVarint( p, end, zz ))) break;
+		a += (address)((zz >> 1) ^ (0 - (zz & 1)));
+		if (flags & 8) if (!(p = GetVarint( p, end, site ))) break;
+		if (flags & 16) if (!(p = GetVarint( p, end, core ))) break;
+		out[n].a = a;
+		out[n].size = sizes[flags & 3];
+		out[n].write = (flags >> 2) & 1;
+		out[n].site = (unsigned short)site;
+		out[n].core = (byte)core;
+		n++;
+	}
+	return n;
+}
+
+// ------------------------------------------------------------------
+// LZ77 BLOCK CODER
+// Sequences of: token (high nibble literal count, low nibble match
+// length - 4; 15 means more length bytes follow, 255 = continue),
+// literals, 16-bit match offset. The last sequence has literals only.
+// ------------------------------------------------------------------
+
+#define LZHASHBITS		12
+#define LZMINMATCH		4
+
+static uint Read32( const byte* p ) { uint v; memcpy( &v, p, 4 ); return v; }
+
+static byte* PutLength( byte* op, int len )
+{
+	for (len -= 15; len >= 255; len -= 255) *op++ = 255;
+	*op++ = (byte)len;
+	return op;
+}
+
+int TraceCompressBound( int size ) { return size + size / 255 + 16; }
+
+int TraceCompress( const byte* src, int size, byte* dst )
+{
+	int table[1 << LZHASHBITS];
+	memset( table, 0xFF, sizeof( table ) ); // -1: empty
+	byte* op = dst;
+	int ip = 0, anchor = 0;
+	while (ip + LZMINMATCH <= size)
+	{
+		uint seq = Read32( src + ip ), h = (seq * 2654435761u) >> (32 - LZHASHBITS);
+		int ref = table[h];
+		table[h] = ip;
+		if (ref < 0 || ip - ref > 65535 || Read32( src + ref ) != seq) { ip++; continue; }
+		int len = LZMINMATCH;
+		while (ip + len < size && src[ref + len] == src[ip + len]) len++;
+		// emit literals [anchor, ip) and the match
+		int lit = ip - anchor, m = len - LZMINMATCH;
+		*op++ = (byte)(((lit < 15 ? lit : 15) << 4) | (m < 15 ? m : 15));
+		if (lit >= 15) op = PutLength( op, lit );
+		memcpy( op, src + anchor, lit ), op += lit;
+		*op++ = (byte)(ip - ref), *op++ = (byte)((ip - ref) >> 8);
+		if (m >= 15) op = PutLength( op, m );
+		ip += len, anchor = ip;
+	}
+	// final literals
+	int lit = size - anchor;
+	*op++ = (byte)((lit < 15 ? lit : 15) << 4);
+	if (lit >= 15) op = PutLength( op, lit );
+	memcpy( op, src + anchor, lit ), op += lit;
+	return (int)(op - dst);
+}
+
+int TraceDecompress( const byte* src, int size, byte* dst, int capacity )
+{
+	const byte* ip = src, *end = src + size;
+	byte* op = dst, *oend = dst + capacity;
+	while (ip < end)
+	{
+		int token = *ip++, lit = token >> 4, len = token & 15;
+		if (lit == 15) { int b; do { if (ip >= end) return -1; b = *ip++; lit += b; } while (b == 255); }
+		if (lit > end - ip || lit > oend - op) return -1;
+		memcpy( op, ip, lit ), op += lit, ip += lit;
+		if (ip >= end) break; // last sequence
+		if (end - ip < 2) return -1;
+		int offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+		if (len == 15) { int b; do { if (ip >= end) return -1; b = *ip++; len += b; } while (b == 255); }
+		len += LZMINMATCH;
+		if (offset == 0 || offset > op - dst || len > oend - op) return -1;
+		// byte by byte: the match may overlap the output it is copying
+		const byte* m = op - offset;
+		for (int i = 0; i < len; i++) op[i] = m[i];
+		op += len;
+	}
+	return (int)(op - dst);
+}
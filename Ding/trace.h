@@ -0,0 +1,90 @@
+#pragma once
+
+// ------------------------------------------------------------------
+// MEMORY ACCESS TRACES
+// Binary recording of the access stream (Game::Set/Get), so a
+// workload can be recorded once and replayed through many cache
+// configurations. File layout:
+//   header: "TRC1", uint version
+//   blocks: uint rawSize, uint packedSize, uint records, packed bytes
+// Records in a block are encoded as a flags byte (size code, write,
+// site change, core change), the zigzag varint delta to the previous
+// address and, if they changed, the varint site and core ids. Every
+// block starts from address 0 / site 0 / core 0, so blocks decode
+// independently. Blocks are compressed
+// with a small LZ77 coder (packedSize == rawSize: stored as is).
+// ------------------------------------------------------------------
+
+#define TRACEMAGIC		0x31435254				// "TRC1"
+#define TRACEVERSION	1
+#define TRACEBLOCK		65536					// raw bytes per block
+#define TRACERECORDMAX	16						// flags + 5-byte address delta + 5-byte site + 5-byte core
+#define TRACEBLOCKRECORDS	(TRACEBLOCK / 2)	// records per block, at most (smallest record: 2 bytes)
+#define REPLAYCHUNK		(16 * TRACEBLOCKRECORDS)	// records decoded per TraceReader::Read in replay loops
+#define TRACEWINDOW		(64 * 1024 * 1024)		// bytes of the trace file mapped at a time
+
+struct TraceRecord
+{
+	address a;								// byte address
+	byte size;								// access size in bytes: 1, 2 or 4
+	byte write;								// 0: read, 1: write
+	unsigned short site;					// access site (0: unknown)
+	byte core;								// issuing core (see HierarchyConfig::cores)
+};
+
+class TraceWriter
+{
+public:
+	TraceWriter();
+	~TraceWriter();
+	bool Open( const char* fileName );
+	void Record( address a, int size, bool write, int site = 0, int core = 0 );
+	void Close();
+	// stats: records written, encoded block bytes, file bytes
+	unsigned long long records, rawBytes, packedBytes;
+private:
+	void Flush();
+	FILE* file;
+	byte raw[TRACEBLOCK + TRACERECORDMAX];
+	byte* packed;
+	int rawSize, blockRecords;
+	address lastAddress;
+	int lastSite, lastCore;
+};
+
+// Streams a trace file through a sliding memory-mapped window, so
+// traces larger than RAM (or than the address space, in 32-bit
+// builds) replay without loading them; the OS pages the file in.
+class TraceReader
+{
+public:
+	TraceReader();
+	~TraceReader();
+	bool Open( const char* fileName );
+	// decode whole blocks into out (room for at least TRACEBLOCKRECORDS records);
+	// returns the number of records, 0 at the end of the trace, -1 if it is corrupt
+	int Read( TraceRecord* out, int maxRecords );
+	void Close();
+	unsigned long long fileSize, offset;		// offset: start of the next block
+private:
+	const byte* Map( unsigned long long pos, uint size );	// file bytes [pos, pos + size), or NULL past the end
+	void Unmap();
+#ifdef _WIN32
+	HANDLE file, mapping;
+#else
+	int file;
+#endif
+	const byte* view;
+	unsigned long long viewStart;
+	uint viewSize, granularity;
+	byte* raw;
+};
+
+// decode the records of one raw (decompressed) block; returns the number of records written to out
+int DecodeTraceBlock( const byte* raw, int rawSize, TraceRecord* out, int maxRecords );
+
+// LZ77 block coder used for trace blocks. Compress returns the packed size (dst must hold
+// TraceCompressBound( size ) bytes); Decompress returns the unpacked size, or -1 on corrupt input.
+int TraceCompressBound( int size );
+int TraceCompress( const byte* src, int size, byte* dst );
+int TraceDecompress( const byte* src, int size, byte* dst, int capacity );